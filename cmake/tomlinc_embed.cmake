@@ -0,0 +1,31 @@
+# tomlinc_embed(<target> <toml file> <symbol>)
+#
+# Parses <toml file> at build time and compiles it into <target> as a static,
+# read-only TomlTable tree. The generated header <symbol>.h declares
+#
+#   extern const TomlTable *const <symbol>;
+#
+# which can be passed straight to the tomlinc_get_* functions and
+# tomlinc_print_table without any parsing or allocation at startup.
+
+set(TOMLINC_EMBED_SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR}/../src)
+
+function(tomlinc_embed target toml_file symbol)
+    get_filename_component(toml_path ${toml_file} ABSOLUTE)
+    set(output_dir ${CMAKE_CURRENT_BINARY_DIR}/tomlinc_embed)
+    set(output_source ${output_dir}/${symbol}.c)
+    set(output_header ${output_dir}/${symbol}.h)
+
+    add_custom_command(
+        OUTPUT ${output_source} ${output_header}
+        COMMAND ${CMAKE_COMMAND} -E make_directory ${output_dir}
+        COMMAND tomlinc_embed_gen ${toml_path} ${symbol} ${output_source} ${output_header}
+        DEPENDS tomlinc_embed_gen ${toml_path}
+        COMMENT "Embedding ${toml_file} as ${symbol}"
+        VERBATIM
+    )
+
+    target_sources(${target} PRIVATE ${output_source} ${output_header})
+    # The generated source needs the private struct layouts
+    target_include_directories(${target} PRIVATE ${output_dir} ${TOMLINC_EMBED_SOURCE_DIR})
+endfunction()
@@ -0,0 +1,52 @@
+#include <cstdio>
+#include "tomlinc.hpp"
+
+// The example.c walkthrough, through the C++ wrapper
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <input.toml> [output.toml]\n", argv[0]);
+        return 1;
+    }
+
+    tomlinc::Document config = tomlinc::Document::open(argv[1]);
+    if (!config) {
+        std::fprintf(stderr, "Failed to parse %s\n", argv[1]);
+        return 1;
+    }
+
+    if (auto log_level = config.get<int>("general", "log_level")) {
+        std::printf("[general] get log_level: %d\n", *log_level);
+    }
+
+    if (auto server = config.get<std::string_view>("integration.mqtt", "server")) {
+        std::printf("[integration.mqtt] get mqtt server: %.*s\n", static_cast<int>(server->size()), server->data());
+    }
+
+    // Wrong types come back empty instead of reinterpreting the value
+    if (!config.get<std::string_view>("general", "log_level")) {
+        std::printf("[general] log_level is not a string\n");
+    }
+
+    tomlinc::Array mixed = config.array("integration.settings", "mixed");
+    std::printf("[integration.settings] mixed has %zu values\n", mixed.size());
+    for (tomlinc::Element element : mixed) {
+        if (auto integer = element.get<int>()) {
+            std::printf("  [%zu] int %d\n", element.index(), *integer);
+        } else if (auto floating = element.get<double>()) {
+            std::printf("  [%zu] float %g\n", element.index(), *floating);
+        } else if (auto flag = element.get<bool>()) {
+            std::printf("  [%zu] bool %s\n", element.index(), *flag ? "true" : "false");
+        } else if (auto text = element.get<std::string>()) {
+            std::printf("  [%zu] string %s\n", element.index(), text->c_str());
+        }
+    }
+
+    if (config.set("integration.mqtt", "qos", 1)) {
+        std::printf("[integration.mqtt] set qos: %d\n", config.get<int>("integration.mqtt", "qos").value_or(-1));
+    }
+
+    // Moving hands over ownership, the file is closed once
+    tomlinc::Document moved = std::move(config);
+    if (argc > 2 && !moved.save(argv[2])) return 1;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "tomlinc.h"
+#include "example_config.h"
+
+int main(void) {
+    // example.toml was parsed at build time, nothing is parsed or allocated here
+    tomlinc_print_table(example_config, 0);
+
+    printf("\n");
+
+    int log_level;
+    if (tomlinc_get_int_value(example_config, "general", "log_level", &log_level) == 0) {
+        printf("[general] get log_level: %d\n", log_level);
+    } else {
+        printf("[general] Failed to get log_level.\n");
+    }
+
+    const char *get_mqtt_server = tomlinc_get_string_value(example_config, "integration.mqtt", "server");
+    if (get_mqtt_server) {
+        printf("[integration.mqtt] get mqtt server: %s\n", get_mqtt_server);
+    } else {
+        printf("[integration.mqtt] Failed to get mqtt server\n");
+    }
+
+    void *mixed_array = tomlinc_get_array_from_table(example_config, "integration.settings", "mixed");
+    size_t array_size = 0;
+    if (mixed_array && tomlinc_get_array_size(mixed_array, &array_size) == 0) {
+        printf("[integration.settings] mixed has %zu values\n", array_size);
+    } else {
+        printf("[integration.settings] mixed not found\n");
+    }
+
+    return 0;
+}
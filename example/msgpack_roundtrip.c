@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tomlinc.h"
+
+// Round-trip check for the MessagePack encoding. A document with nested
+// arrays of tables is encoded, decoded again and compared with the original,
+// both with tomlinc_diff and through the getters. Exits non-zero on a mismatch.
+//
+// Usage: msgpack_roundtrip [TOML file]
+
+static const char config[] =
+    "[general]\n"
+    "name = \"gateway\"\n"
+    "\n"
+    "[[device]]\n"
+    "id = 1\n"
+    "\n"
+    "[device.radio]\n"
+    "freq = 868.1\n"
+    "\n"
+    "[[device.channel]]\n"
+    "n = 1\n"
+    "\n"
+    "[[device.channel.pin]]\n"
+    "p = 7\n"
+    "\n"
+    "[[device]]\n"
+    "id = 2\n"
+    "\n"
+    "[[device.channel]]\n"
+    "n = 3\n"
+    "\n"
+    "[[device.x.y]]\n"
+    "q = 4\n";
+
+static int write_config(char *path) {
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        return -1;
+    }
+    fputs(config, file);
+    return fclose(file);
+}
+
+static void count_difference(const char *table_path, const char *key, TomlDiffKind kind, void *userdata) {
+    printf("  difference: %s %s (%d)\n", table_path, key ? key : "", (int)kind);
+    (*(int *)userdata)++;
+}
+
+static int check_int(const TomlTable *root, const char *table_path, const char *key, int expected) {
+    int value;
+    if (tomlinc_get_int_value(root, table_path, key, &value) == 0 && value == expected) return 0;
+    printf("  %s.%s did not read back as %d\n", table_path, key, expected);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    char path[] = "/tmp/msgpack_roundtrip_XXXXXX";
+    const char *filename = argc > 1 ? argv[1] : path;
+    if (argc <= 1 && write_config(path) != 0) {
+        perror("Failed to write the test document");
+        return 1;
+    }
+
+    TomlTable *original = tomlinc_open_file(filename);
+    if (argc <= 1) remove(path);
+    if (!original) {
+        fprintf(stderr, "Failed to open TOML file: %s\n", filename);
+        return 1;
+    }
+
+    size_t length;
+    tomlinc_to_msgpack_buffer(original, NULL, 0, &length);
+    unsigned char *packed = malloc(length ? length : 1);
+    if (!packed || tomlinc_to_msgpack_buffer(original, packed, length, &length) != 0) {
+        fprintf(stderr, "Failed to encode the document\n");
+        return 1;
+    }
+
+    TomlTable *copy = tomlinc_from_msgpack(packed, length);
+    free(packed);
+    if (!copy) {
+        fprintf(stderr, "Failed to decode the document\n");
+        return 1;
+    }
+
+    int failures = 0;
+    if (tomlinc_diff(original, copy, count_difference, &failures) != 0) failures++;
+    if (argc <= 1) {
+        failures += check_int(copy, "device[1]", "id", 2);
+        failures += check_int(copy, "device.channel[1]", "n", 3);
+        failures += check_int(copy, "device.channel.pin[0]", "p", 7);
+        failures += check_int(copy, "device.x.y[0]", "q", 4);
+    }
+
+    printf("%zu bytes, %s\n", length, failures ? "round trip FAILED" : "round trip ok");
+    tomlinc_close_file(copy);
+    tomlinc_close_file(original);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "tomlinc.h"
+
+// Stress test and throughput benchmark for scalar values that are read and
+// written from several threads at once. Writer threads keep setting int, float
+// and bool values (and array elements) while reader threads poll them through
+// the getters and check that they only ever see values that were written.
+//
+// Usage: scalar_bench [readers] [writers] [seconds]
+
+#define KEY_COUNT 16
+
+typedef struct {
+    TomlTable *root;
+    size_t id;
+    size_t writers;
+    unsigned long long operations;
+    unsigned long long errors;
+} Worker;
+
+static atomic_int running = 1;
+
+static int write_config(char *path) {
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        return -1;
+    }
+    fprintf(file, "[metrics]\n");
+    for (int i = 0; i < KEY_COUNT; i++) {
+        fprintf(file, "limit_%d = 0\nratio_%d = 0.5\nenabled_%d = false\n", i, i, i);
+    }
+    fprintf(file, "levels = [");
+    for (int i = 0; i < KEY_COUNT; i++) {
+        fprintf(file, "%s0", i ? ", " : "");
+    }
+    fprintf(file, "]\n");
+    return fclose(file);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Each writer owns the keys with index % writers == id and counts upwards, so
+// every int a reader sees must be at least the last one it saw for that key.
+// Elements of one array are set by one thread at a time, writer 0 here.
+static void *writer_thread(void *arg) {
+    Worker *worker = (Worker *)arg;
+    char key[32];
+
+    for (int value = 1; atomic_load_explicit(&running, memory_order_relaxed); value++) {
+        for (size_t i = worker->id; i < KEY_COUNT; i += worker->writers) {
+            float ratio = (float)(value % 1024) + 0.5f; // Exact in a float, any tearing shows
+            int enabled = value & 1;
+
+            snprintf(key, sizeof(key), "limit_%zu", i);
+            if (tomlinc_set_int_value(worker->root, "metrics", key, value) != 0) worker->errors++;
+            snprintf(key, sizeof(key), "ratio_%zu", i);
+            if (tomlinc_set_float_value(worker->root, "metrics", key, ratio) != 0) worker->errors++;
+            snprintf(key, sizeof(key), "enabled_%zu", i);
+            if (tomlinc_set_bool_value(worker->root, "metrics", key, enabled) != 0) worker->errors++;
+            worker->operations += 3;
+        }
+        for (size_t i = 0; worker->id == 0 && i < KEY_COUNT; i++) {
+            if (tomlinc_array_set_value(worker->root, "metrics", "levels", i, &value, TOML_VALUE_INT) != 0) worker->errors++;
+            worker->operations++;
+        }
+    }
+    return NULL;
+}
+
+static void *reader_thread(void *arg) {
+    Worker *worker = (Worker *)arg;
+    int last_limit[KEY_COUNT] = {0};
+    int last_level[KEY_COUNT] = {0};
+    char limit_keys[KEY_COUNT][32], ratio_keys[KEY_COUNT][32], enabled_keys[KEY_COUNT][32];
+
+    for (int i = 0; i < KEY_COUNT; i++) {
+        snprintf(limit_keys[i], sizeof(limit_keys[i]), "limit_%d", i);
+        snprintf(ratio_keys[i], sizeof(ratio_keys[i]), "ratio_%d", i);
+        snprintf(enabled_keys[i], sizeof(enabled_keys[i]), "enabled_%d", i);
+    }
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        void *levels = tomlinc_get_array_from_table(worker->root, "metrics", "levels");
+
+        for (size_t i = 0; i < KEY_COUNT; i++) {
+            int limit, enabled, level;
+            float ratio;
+
+            if (tomlinc_get_int_value(worker->root, "metrics", limit_keys[i], &limit) != 0 || limit < last_limit[i]) {
+                worker->errors++;
+            } else {
+                last_limit[i] = limit;
+            }
+            if (tomlinc_get_float_value(worker->root, "metrics", ratio_keys[i], &ratio) != 0 ||
+                ratio - (float)(int)ratio != 0.5f) {
+                worker->errors++;
+            }
+            if (tomlinc_get_bool_value(worker->root, "metrics", enabled_keys[i], &enabled) != 0 || (enabled != 0 && enabled != 1)) {
+                worker->errors++;
+            }
+            if (!levels || tomlinc_array_get_int(levels, i, &level) != 0 || level < last_level[i]) {
+                worker->errors++;
+            } else {
+                last_level[i] = level;
+            }
+            worker->operations += 4;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    size_t readers = argc > 1 ? (size_t)atoi(argv[1]) : 32;
+    size_t writers = argc > 2 ? (size_t)atoi(argv[2]) : 1;
+    double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+    if (readers < 1 || writers < 1 || writers > KEY_COUNT || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [readers] [writers 1-%d] [seconds]\n", argv[0], KEY_COUNT);
+        return 1;
+    }
+
+    char path[] = "/tmp/scalar_bench_XXXXXX";
+    if (write_config(path) != 0) {
+        perror("Failed to write the benchmark config");
+        return 1;
+    }
+    TomlTable *root = tomlinc_open_file(path);
+    remove(path);
+    if (!root) {
+        fprintf(stderr, "Failed to parse the benchmark config\n");
+        return 1;
+    }
+
+    size_t count = readers + writers;
+    Worker *workers = calloc(count, sizeof(Worker));
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    if (!workers || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        workers[i].root = root;
+        workers[i].id = i < writers ? i : i - writers;
+        workers[i].writers = writers;
+        pthread_create(&threads[i], NULL, i < writers ? writer_thread : reader_thread, &workers[i]);
+    }
+
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&running, 0);
+
+    unsigned long long reads = 0, writes = 0, errors = 0;
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        if (i < writers) {
+            writes += workers[i].operations;
+        } else {
+            reads += workers[i].operations;
+        }
+        errors += workers[i].errors;
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%zu readers, %zu writers, %.2f s\n", readers, writers, elapsed);
+    printf("reads:  %12.0f /s\n", (double)reads / elapsed);
+    printf("writes: %12.0f /s\n", (double)writes / elapsed);
+    printf("errors: %llu\n", errors);
+
+    tomlinc_close_file(root);
+    free(workers);
+    free(threads);
+    return errors == 0 ? 0 : 1;
+}
@@ -3,9 +3,18 @@
 
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct TomlTable TomlTable;
 typedef struct TomlPair TomlPair;
 typedef struct TomlArray TomlArray;
+typedef struct TomlTxn TomlTxn;
+typedef struct TomlQueryPlan TomlQueryPlan;
+typedef struct TomlAotIndex TomlAotIndex;
+typedef struct TomlAotStream TomlAotStream;
+typedef struct TomlSubscription TomlSubscription;
 
 typedef enum {
     TOML_VALUE_INT,
@@ -15,18 +24,96 @@ typedef enum {
     TOML_VALUE_ARRAY
 } TomlValueType;
 
+// Cursor for the tomlinc_iter_* functions, lives on the caller's stack
+typedef struct {
+    const void *next;
+} TomlIter;
+
+// One key/value pair yielded by tomlinc_iter_next_pair
+typedef struct {
+    const char *key;
+    TomlValueType type;
+    union {
+        const char *string;
+        int integer;
+        float floating;
+        int boolean;
+        void *array; // Handle for the tomlinc_array_* functions
+    } value;
+} TomlPairEntry;
+
+// One lookup for tomlinc_get_batch. result must point to an int (INT, BOOL),
+// float (FLOAT), const char * (STRING) or void * array handle (ARRAY) and is
+// only written when the key is found with the expected type.
+typedef struct {
+    const char *table_path;
+    const char *key;
+    TomlValueType type;
+    void *result;
+} TomlQuery;
+
+typedef enum {
+    TOML_DIFF_ADDED,
+    TOML_DIFF_REMOVED,
+    TOML_DIFF_CHANGED
+} TomlDiffKind;
+
+// key is NULL when a whole table (or array-of-tables element) was added or removed.
+// Elements appear in table_path by position, as in "device[2].radio"; the
+// getters, the setters and tomlinc_query_compile accept that form.
+typedef void (*TomlDiffCallback)(const char *table_path, const char *key, TomlDiffKind kind, void *userdata);
+
+typedef enum {
+    TOML_TRACE_OPEN,       // All of tomlinc_open_file
+    TOML_TRACE_PARSE,      // Reading and parsing the lines
+    TOML_TRACE_HASH,       // Fingerprinting the parsed tree
+    TOML_TRACE_LOOKUP,     // Resolving one table path and key for a getter
+    TOML_TRACE_ARRAY_GROW, // Growing an array for tomlinc_array_add_value
+    TOML_TRACE_SAVE        // tomlinc_save_file
+} TomlTraceSpan;
+
+// One begin or end event. name is the file (OPEN, PARSE, HASH, SAVE) or the
+// table path (LOOKUP) or table name (ARRAY_GROW); key is only set for LOOKUP
+// and ARRAY_GROW. End events carry the counts:
+//   OPEN, PARSE, HASH: bytes read, tables and pairs parsed
+//   LOOKUP:            nodes is 1 when the key was found
+//   ARRAY_GROW:        bytes for the elements and element count, on begin too
+//   SAVE:              bytes written, tables and pairs written
+typedef struct {
+    TomlTraceSpan span;
+    int end;
+    const char *name;
+    const char *key;
+    size_t bytes;
+    size_t nodes;
+} TomlTraceEvent;
+
+typedef void (*TomlTraceCallback)(const TomlTraceEvent *event, void *userdata);
+
+// Called after a setter changed key in table_path, both only valid during the call
+typedef void (*TomlChangeCallback)(TomlTable *root_table, const char *table_path, const char *key, void *userdata);
+
+// Called for every pair matched by tomlinc_query_run, return non-zero to stop
+typedef int (*TomlMatchCallback)(const TomlTable *table, const TomlPairEntry *match, void *userdata);
+
+// Receives serialized output in pieces, return non-zero to abort
+typedef int (*TomlSink)(const char *data, size_t len, void *userdata);
+
 // API for users
 TomlTable *tomlinc_open_file(const char *filename);
+TomlTable *tomlinc_open_file_filtered(const char *filename, const char *const *table_prefixes, size_t prefix_count);
 void tomlinc_close_file(TomlTable *table);
 int tomlinc_save_file(const TomlTable *root, const char *filename);
 void tomlinc_print_table(const TomlTable *table, int indent);
 
-char *tomlinc_get_string_value(TomlTable *root_table, const char *table_path, const char *key);
+char *tomlinc_get_string_value(const TomlTable *root_table, const char *table_path, const char *key);
 int tomlinc_set_string_value(TomlTable *root_table, const char *table_path, const char *key, const char *new_value);
-int tomlinc_get_int_value(TomlTable *root_table, const char *table_path, const char *key, int *result);
+int tomlinc_get_int_value(const TomlTable *root_table, const char *table_path, const char *key, int *result);
 int tomlinc_set_int_value(TomlTable *root_table, const char *table_path, const char *key, int new_value);
-int tomlinc_get_bool_value(TomlTable *root_table, const char *table_path, const char *key, int *result);
+int tomlinc_get_bool_value(const TomlTable *root_table, const char *table_path, const char *key, int *result);
 int tomlinc_set_bool_value(TomlTable *root_table, const char *table_path, const char *key, int new_value);
+int tomlinc_get_float_value(const TomlTable *root_table, const char *table_path, const char *key, float *result);
+int tomlinc_set_float_value(TomlTable *root_table, const char *table_path, const char *key, float new_value);
 void *tomlinc_get_array_from_table(const TomlTable *root_table, const char *table_path, const char *key);
 int tomlinc_get_array_size(void *array_handle, size_t *size);
 int tomlinc_array_value_is_string(void *array_handle, size_t index);
@@ -40,4 +127,72 @@ int tomlinc_array_get_bool(void *array_handle, size_t index, int *result);
 int tomlinc_array_set_value(TomlTable *root_table, const char *table_path, const char *key, size_t index, void *new_value, TomlValueType value_type);
 int tomlinc_array_add_value(TomlTable *root_table, const char *table_path, const char *key, void *new_value, TomlValueType value_type);
 
+const TomlTable *tomlinc_get_table(const TomlTable *root_table, const char *table_path);
+const char *tomlinc_table_name(const TomlTable *table);
+int tomlinc_table_is_array_of_tables(const TomlTable *table);
+int tomlinc_aot_count(const TomlTable *root_table, const char *table_path, size_t *count);
+const TomlTable *tomlinc_aot_get(const TomlTable *root_table, const char *table_path, size_t index);
+TomlAotIndex *tomlinc_aot_create_index(const TomlTable *root_table, const char *table_path, const char *key);
+const TomlTable *tomlinc_aot_find(TomlAotIndex *index, const void *value, TomlValueType type);
+void tomlinc_aot_free_index(TomlAotIndex *index);
+TomlAotStream *tomlinc_aot_stream_open(const char *filename, const char *table_path);
+const TomlTable *tomlinc_aot_stream_next(TomlAotStream *stream);
+void tomlinc_aot_stream_close(TomlAotStream *stream);
+void tomlinc_iter_tables(const TomlTable *root_table, TomlIter *iter);
+void tomlinc_iter_subtables(const TomlTable *table, TomlIter *iter);
+void tomlinc_iter_array_of_tables(const TomlTable *table, TomlIter *iter);
+const TomlTable *tomlinc_iter_next_table(TomlIter *iter);
+void tomlinc_iter_pairs(const TomlTable *table, TomlIter *iter);
+int tomlinc_iter_next_pair(TomlIter *iter, TomlPairEntry *entry);
+
+int tomlinc_get_batch(const TomlTable *root_table, const TomlQuery *queries, size_t count);
+
+TomlTxn *tomlinc_txn_begin(TomlTable *root_table);
+int tomlinc_txn_commit(TomlTxn *txn, const char *filename);
+void tomlinc_txn_abort(TomlTxn *txn);
+
+int tomlinc_autosave_start(TomlTable *root_table, const char *path, unsigned int debounce_ms);
+int tomlinc_autosave_flush(TomlTable *root_table);
+int tomlinc_autosave_stop(TomlTable *root_table);
+
+int tomlinc_journal_start(TomlTable *root_table, const char *filename, size_t compact_size);
+int tomlinc_journal_sync(TomlTable *root_table);
+int tomlinc_journal_stop(TomlTable *root_table);
+
+TomlSubscription *tomlinc_subscribe(TomlTable *root_table, const char *table_path, const char *key, TomlChangeCallback callback, void *userdata);
+void tomlinc_unsubscribe(TomlTable *root_table, TomlSubscription *subscription);
+
+void tomlinc_set_trace_callback(TomlTraceCallback callback, void *userdata);
+
+int tomlinc_diff(const TomlTable *old_root, const TomlTable *new_root, TomlDiffCallback callback, void *userdata);
+
+TomlTable *tomlinc_fork(TomlTable *root_table);
+
+TomlTable *tomlinc_overlay_create(const TomlTable *const *layers, size_t count);
+
+TomlQueryPlan *tomlinc_query_compile(const char *pattern);
+int tomlinc_query_run(const TomlQueryPlan *plan, const TomlTable *root_table, TomlMatchCallback callback, void *userdata);
+void tomlinc_query_free(TomlQueryPlan *plan);
+
+int tomlinc_to_json(const TomlTable *root_table, int pretty, TomlSink sink, void *userdata);
+int tomlinc_to_json_buffer(const TomlTable *root_table, int pretty, char *buffer, size_t size, size_t *length);
+
+int tomlinc_to_msgpack(const TomlTable *root_table, TomlSink sink, void *userdata);
+int tomlinc_to_msgpack_buffer(const TomlTable *root_table, void *buffer, size_t size, size_t *length);
+TomlTable *tomlinc_from_msgpack(const void *data, size_t size);
+
+int tomlinc_shm_publish(const TomlTable *root_table, const char *name);
+int tomlinc_shm_unpublish(const char *name);
+TomlTable *tomlinc_shm_attach(const char *name);
+int tomlinc_shm_refresh(TomlTable *handle);
+
+TomlTable *tomlinc_freeze(const TomlTable *root_table);
+
+TomlTable *tomlinc_open_file_static(const char *filename, void *pool, size_t pool_size);
+size_t tomlinc_pool_used(const TomlTable *root_table);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // TOMLINC_H
\ No newline at end of file
@@ -0,0 +1,252 @@
+#ifndef TOMLINC_HPP
+#define TOMLINC_HPP
+
+// Header-only C++17 wrapper around tomlinc.h. Documents are owned RAII
+// handles, lookups return std::optional, and keys are passed through to the C
+// getters without allocating: C strings and std::string go as they are, a
+// std::string_view is copied into a stack buffer to add the terminator.
+
+#include "tomlinc.h"
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace tomlinc {
+
+enum class Type {
+    Int = TOML_VALUE_INT,
+    Float = TOML_VALUE_FLOAT,
+    String = TOML_VALUE_STRING,
+    Bool = TOML_VALUE_BOOL,
+    Array = TOML_VALUE_ARRAY
+};
+
+// A NUL-terminated view of a path, key or file name for the C API
+class CStr {
+public:
+    CStr(const char *str) noexcept : str_(str) {}
+    CStr(const std::string &str) noexcept : str_(str.c_str()) {}
+    CStr(std::string_view str) {
+        char *target = inline_;
+        if (str.size() >= sizeof(inline_)) {
+            heap_.reset(new char[str.size() + 1]);
+            target = heap_.get();
+        }
+        std::memcpy(target, str.data(), str.size());
+        target[str.size()] = '\0';
+        str_ = target;
+    }
+
+    CStr(const CStr &) = delete;
+    CStr &operator=(const CStr &) = delete;
+
+    const char *c_str() const noexcept { return str_; }
+
+private:
+    const char *str_;
+    char inline_[128];
+    std::unique_ptr<char[]> heap_; // Only for views longer than the inline buffer
+};
+
+class Array;
+
+// One element of an Array, yielded by its iterator
+class Element {
+public:
+    Element(void *handle, std::size_t index) noexcept : handle_(handle), index_(index) {}
+
+    std::size_t index() const noexcept { return index_; }
+    std::optional<Type> type() const noexcept;
+    template <typename T> std::optional<T> get() const;
+
+private:
+    void *handle_;
+    std::size_t index_;
+};
+
+// Non-owning view of an array value, valid while its document is unchanged
+class Array {
+public:
+    class Iterator {
+    public:
+        Iterator(void *handle, std::size_t index) noexcept : handle_(handle), index_(index) {}
+        Element operator*() const noexcept { return Element(handle_, index_); }
+        Iterator &operator++() noexcept {
+            ++index_;
+            return *this;
+        }
+        bool operator==(const Iterator &other) const noexcept { return index_ == other.index_; }
+        bool operator!=(const Iterator &other) const noexcept { return index_ != other.index_; }
+
+    private:
+        void *handle_;
+        std::size_t index_;
+    };
+
+    Array() noexcept = default;
+    explicit Array(void *handle) noexcept : handle_(handle) {}
+
+    explicit operator bool() const noexcept { return handle_ != nullptr; }
+    void *handle() const noexcept { return handle_; }
+
+    std::size_t size() const noexcept {
+        std::size_t size = 0;
+        if (handle_) tomlinc_get_array_size(handle_, &size);
+        return size;
+    }
+    bool empty() const noexcept { return size() == 0; }
+
+    Element operator[](std::size_t index) const noexcept { return Element(handle_, index); }
+    template <typename T> std::optional<T> get(std::size_t index) const { return Element(handle_, index).get<T>(); }
+
+    Iterator begin() const noexcept { return Iterator(handle_, 0); }
+    Iterator end() const noexcept { return Iterator(handle_, size()); }
+
+private:
+    void *handle_ = nullptr;
+};
+
+inline std::optional<Type> Element::type() const noexcept {
+    if (!handle_) return std::nullopt;
+    if (tomlinc_array_value_is_int(handle_, index_) == 1) return Type::Int;
+    if (tomlinc_array_value_is_float(handle_, index_) == 1) return Type::Float;
+    if (tomlinc_array_value_is_string(handle_, index_) == 1) return Type::String;
+    if (tomlinc_array_value_is_bool(handle_, index_) == 1) return Type::Bool;
+    return std::nullopt; // Out of range
+}
+
+template <typename T> std::optional<T> Element::get() const {
+    if (!handle_) return std::nullopt;
+
+    if constexpr (std::is_same_v<T, bool>) {
+        int value;
+        if (tomlinc_array_get_bool(handle_, index_, &value) != 0) return std::nullopt;
+        return value != 0;
+    } else if constexpr (std::is_integral_v<T>) {
+        int value;
+        if (tomlinc_array_get_int(handle_, index_, &value) != 0) return std::nullopt;
+        return static_cast<T>(value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        float value;
+        if (tomlinc_array_get_float(handle_, index_, &value, nullptr) != 0) return std::nullopt;
+        return static_cast<T>(value);
+    } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, const char *>) {
+        const char *value = tomlinc_array_get_string(handle_, index_);
+        if (!value) return std::nullopt;
+        return T(value);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        const char *value = tomlinc_array_get_string(handle_, index_);
+        if (!value) return std::nullopt;
+        return std::string(value);
+    } else {
+        static_assert(!sizeof(T), "Element::get supports bool, integers, floating point and strings");
+    }
+}
+
+// Owns a root table: a parsed file, a fork, an overlay or an attached image.
+// Move-only; tomlinc_close_file runs when it goes out of scope.
+class Document {
+public:
+    Document() noexcept = default;
+    explicit Document(TomlTable *root) noexcept : root_(root) {}
+    ~Document() { tomlinc_close_file(root_); }
+
+    Document(Document &&other) noexcept : root_(std::exchange(other.root_, nullptr)) {}
+    Document &operator=(Document &&other) noexcept {
+        if (this != &other) {
+            tomlinc_close_file(root_);
+            root_ = std::exchange(other.root_, nullptr);
+        }
+        return *this;
+    }
+    Document(const Document &) = delete;
+    Document &operator=(const Document &) = delete;
+
+    // Empty (false) when the file cannot be read or parsed
+    static Document open(const CStr &filename) noexcept { return Document(tomlinc_open_file(filename.c_str())); }
+
+    explicit operator bool() const noexcept { return root_ != nullptr; }
+    TomlTable *handle() const noexcept { return root_; }
+    TomlTable *release() noexcept { return std::exchange(root_, nullptr); }
+
+    bool save(const CStr &filename) const noexcept { return root_ && tomlinc_save_file(root_, filename.c_str()) == 0; }
+
+    // Copy-on-write snapshot, see tomlinc_fork
+    Document fork() const noexcept { return Document(root_ ? tomlinc_fork(root_) : nullptr); }
+
+    // Read-only flat copy, see tomlinc_freeze
+    Document freeze() const noexcept { return Document(root_ ? tomlinc_freeze(root_) : nullptr); }
+
+    // Value of key in table_path, empty when it is missing or has another type.
+    // Strings are borrowed as std::string_view or const char *, or copied into std::string.
+    template <typename T> std::optional<T> get(const CStr &table_path, const CStr &key) const {
+        if (!root_) return std::nullopt;
+        const char *path = table_path.c_str();
+        const char *name = key.c_str();
+
+        if constexpr (std::is_same_v<T, bool>) {
+            int value;
+            if (tomlinc_get_bool_value(root_, path, name, &value) != 0) return std::nullopt;
+            return value != 0;
+        } else if constexpr (std::is_integral_v<T>) {
+            int value;
+            if (tomlinc_get_int_value(root_, path, name, &value) != 0) return std::nullopt;
+            return static_cast<T>(value);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            float value;
+            if (tomlinc_get_float_value(root_, path, name, &value) != 0) return std::nullopt;
+            return static_cast<T>(value);
+        } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, const char *> ||
+                             std::is_same_v<T, std::string>) {
+            // Unlike tomlinc_get_string_value, a batch lookup checks the type
+            const char *value = nullptr;
+            TomlQuery query = {path, name, TOML_VALUE_STRING, &value};
+            if (tomlinc_get_batch(root_, &query, 1) != 0) return std::nullopt;
+            return T(value);
+        } else if constexpr (std::is_same_v<T, Array>) {
+            void *handle = tomlinc_get_array_from_table(root_, path, name);
+            if (!handle) return std::nullopt;
+            return Array(handle);
+        } else {
+            static_assert(!sizeof(T), "Document::get supports bool, integers, floating point, strings and Array");
+        }
+    }
+
+    // Array value of key in table_path, an empty Array when there is none
+    Array array(const CStr &table_path, const CStr &key) const noexcept {
+        return Array(root_ ? tomlinc_get_array_from_table(root_, table_path.c_str(), key.c_str()) : nullptr);
+    }
+
+    // Change an existing value of the same type, false when there is none
+    bool set(const CStr &table_path, const CStr &key, int value) noexcept {
+        return root_ && tomlinc_set_int_value(root_, table_path.c_str(), key.c_str(), value) == 0;
+    }
+    bool set(const CStr &table_path, const CStr &key, bool value) noexcept {
+        return root_ && tomlinc_set_bool_value(root_, table_path.c_str(), key.c_str(), value ? 1 : 0) == 0;
+    }
+    bool set(const CStr &table_path, const CStr &key, float value) noexcept {
+        return root_ && tomlinc_set_float_value(root_, table_path.c_str(), key.c_str(), value) == 0;
+    }
+    bool set(const CStr &table_path, const CStr &key, double value) noexcept {
+        return set(table_path, key, static_cast<float>(value));
+    }
+    bool set(const CStr &table_path, const CStr &key, const CStr &value) noexcept {
+        return root_ && tomlinc_set_string_value(root_, table_path.c_str(), key.c_str(), value.c_str()) == 0;
+    }
+    bool set(const CStr &table_path, const CStr &key, const char *value) noexcept {
+        return root_ && value && tomlinc_set_string_value(root_, table_path.c_str(), key.c_str(), value) == 0;
+    }
+
+private:
+    TomlTable *root_ = nullptr;
+};
+
+} // namespace tomlinc
+
+#endif // TOMLINC_HPP
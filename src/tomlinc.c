@@ -8,17 +8,58 @@
 #include <stdbool.h>
 #include <math.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Read the next line into line, which getline grows as needed unless fixed
+// is set. A line that does not fit a fixed buffer is an error.
+static int read_line(FILE *file, char **line, size_t *line_capacity, int fixed, int *too_long) {
+    if (!fixed) return getline(line, line_capacity, file) != -1;
+
+    if (!fgets(*line, (int)*line_capacity, file)) return 0;
+    size_t length = strlen(*line);
+    if (length + 1 == *line_capacity && (*line)[length - 1] != '\n' && !feof(file)) {
+        *too_long = 1;
+        return 0;
+    }
+    return 1;
+}
 
-TomlTable *tomlinc_open_file(const char *filename) {
+// Whether a table header names one of the prefixes or a table below it
+static int table_wanted(const char *name, const char *const *table_prefixes, size_t prefix_count) {
+    for (size_t i = 0; i < prefix_count; i++) {
+        size_t len = strlen(table_prefixes[i]);
+        if (len == 0) return 1; // The root, everything is below it
+        if (strncmp(name, table_prefixes[i], len) == 0 && (name[len] == '\0' || name[len] == '.')) return 1;
+    }
+    return 0;
+}
+
+// Parse a file into a document. Lines go into line (line_size bytes) when it
+// is given, as tomlinc_open_file_static does, and into a growing heap buffer
+// otherwise. With table_prefixes, only the tables under them are built, the
+// pairs of all others are stepped over.
+TomlTable *parse_file(const char *filename, char *line, size_t line_size, const char *const *table_prefixes, size_t prefix_count) {
+    TRACE(open__begin, TOML_TRACE_OPEN, 0, filename, NULL, 0, 0);
     FILE *file = fopen(filename, "r");
-    if (!file) return NULL;
+    if (!file) {
+        TRACE(open__end, TOML_TRACE_OPEN, 1, filename, NULL, 0, 0);
+        return NULL;
+    }
 
     TomlTable *root = NULL;
     TomlTable *current_table = NULL;
+    size_t nodes = 0; // Tables and pairs, for tracing
 
-    char line[256];
+    int fixed = line != NULL;
+    int too_long = 0;
+    int skipping = 0; // In a table that the prefixes leave out
+    size_t line_capacity = line_size;
 
-    while (fgets(line, sizeof(line), file)) {
+    TRACE(parse__begin, TOML_TRACE_PARSE, 0, filename, NULL, 0, 0);
+
+    while (read_line(file, &line, &line_capacity, fixed, &too_long)) {
         char *trimmed = trim_whitespace(line);
 
         // Skip empty lines and comments
@@ -32,14 +73,18 @@ TomlTable *tomlinc_open_file(const char *filename) {
                 if (!end) continue; // malformed
                 *end = '\0'; 
                 char *table_name = trim_whitespace(trimmed + 2);
-                current_table = find_or_create_array_of_tables(&root, table_name);
+                skipping = table_prefixes && !table_wanted(table_name, table_prefixes, prefix_count);
+                current_table = skipping ? NULL : find_or_create_array_of_tables(&root, table_name);
+                if (current_table) nodes++;
             } else {
                 // single table
                 char *end_bracket = strchr(trimmed, ']');
                 if (!end_bracket) continue;
                 *end_bracket = '\0';
                 char *table_name = trim_whitespace(trimmed + 1);
-                current_table = find_or_create_table(&root, table_name);
+                skipping = table_prefixes && !table_wanted(table_name, table_prefixes, prefix_count);
+                current_table = skipping ? NULL : find_or_create_table(&root, table_name);
+                if (current_table) nodes++;
             }
         } else if (current_table) {
             // key-value pairs
@@ -52,64 +97,194 @@ TomlTable *tomlinc_open_file(const char *filename) {
                     while (last_pair->next) last_pair = last_pair->next;
                     last_pair->next = pair;
                 }
+                nodes++;
             }
+        } else if (skipping) {
+            // Multi-line arrays have to be consumed, their lines could pass for table headers
+            skip_pair(trimmed, file);
         }
     }
 
+    long position = ftell(file);
+    size_t bytes = position > 0 ? (size_t)position : 0;
+    TRACE(parse__end, TOML_TRACE_PARSE, 1, filename, NULL, bytes, nodes);
+    if (!fixed) free(line);
     fclose(file);
+
+    if (root && too_long) {
+        tomlinc_close_file(root);
+        root = NULL;
+    }
+    if (root) {
+        TRACE(hash__begin, TOML_TRACE_HASH, 0, filename, NULL, 0, 0);
+        rehash_tables(root);
+        TRACE(hash__end, TOML_TRACE_HASH, 1, filename, NULL, bytes, nodes);
+        root->doc = mem_calloc(1, sizeof(TomlDocument));
+        if (!root->doc) {
+            tomlinc_close_file(root);
+            root = NULL;
+        }
+    }
+    TRACE(open__end, TOML_TRACE_OPEN, 1, filename, NULL, root ? bytes : 0, root ? nodes : 0);
     return root;
 }
 
-void tomlinc_close_file(TomlTable *table) {
-    if (!table) return;
+TomlTable *tomlinc_open_file(const char *filename) {
+    return parse_file(filename, NULL, 0, NULL, 0);
+}
 
-    TomlPair *pair = table->pairs;
-    while (pair) {
-        TomlPair *next = pair->next;
-        if (pair->type == TOML_VALUE_ARRAY) {
-            free_array((TomlArray *)pair->value);
-        } else {
-            free(pair->value);
-        }
-        free(pair->key);
-        free(pair);
-        pair = next;
+// Like tomlinc_open_file, but only the tables named by table_prefixes and the
+// tables below them are built; "integration.mqtt" keeps [integration.mqtt]
+// and [integration.mqtt.client], not [integration].
+TomlTable *tomlinc_open_file_filtered(const char *filename, const char *const *table_prefixes, size_t prefix_count) {
+    if (!filename || !table_prefixes) return NULL;
+    for (size_t i = 0; i < prefix_count; i++) {
+        if (!table_prefixes[i]) return NULL;
     }
+    return parse_file(filename, NULL, 0, table_prefixes, prefix_count);
+}
 
-    TomlTable *subtable = table->subtables;
-    while (subtable) {
-        TomlTable *next = subtable->next;
-        free_table(subtable);
-        subtable = next;
-    }
+void tomlinc_close_file(TomlTable *table) {
+    if (!table) return;
+    if (table->doc && table->doc->pool) return; // All of it is in the caller's pool
 
-    // Free array-of-tables
-    TomlTable *aot = table->array_of_tables;
-    while (aot) {
-        TomlTable *next = aot->next;
-        free_table(aot);
-        aot = next;
+    if (table->doc) {
+        if (table->doc->autosave) tomlinc_autosave_stop(table); // Writes out what is pending
+        if (table->doc->journal) tomlinc_journal_stop(table);
+        if (table->doc->txn) txn_discard(table->doc->txn);
+        subscriptions_free(table->doc->subscriptions);
+        cache_free(table->doc);
+        overlay_free(table->doc->overlay);
+        if (table->doc->image) table->doc->image->release(table->doc->image);
+        mem_free(table->doc);
     }
 
-    free(table->name);
-    free(table);
+    // The root is the first top-level table, free it along with its siblings
+    free_tables(table);
 }
 
 int tomlinc_save_file(const TomlTable *root, const char *filename) {
+    if (root && root->doc && root->doc->image) return -1; // Image handles have no tree to write
+    TRACE(save__begin, TOML_TRACE_SAVE, 0, filename, NULL, 0, 0);
     FILE *file = fopen(filename, "w");
     if (!file) {
         perror("Failed to open file for writing");
+        TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, 0, 0);
         return -1;
     }
 
-    write_table_to_file(file, root, 0, NULL);
+    size_t nodes = write_table_to_file(file, root, 0, NULL);
+    long position = ftell(file);
 
-    fclose(file);
+    int write_failed = ferror(file);
+    if (fclose(file) != 0 || write_failed) {
+        perror("Failed to write file");
+        TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, 0, 0);
+        return -1;
+    }
+    TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, position > 0 ? (size_t)position : 0, nodes);
     return 0;
 }
 
+static int sync_directory(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Make a rename of path durable
+static int sync_parent(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return sync_directory(".");
+    if (slash == path) return sync_directory("/");
+
+    char *dir = strndup(path, (size_t)(slash - path));
+    if (!dir) return -1;
+    int result = sync_directory(dir);
+    free(dir);
+    return result;
+}
+
+static atomic_uint temp_serial;
+
+// Create a temporary file next to filename. Transactions, autosaving and
+// journal compaction may all replace the same file, so every call gets a name
+// of its own ("<filename>.<pid>.<n>.tmp") and O_EXCL makes sure it is new.
+static FILE *create_temp_file(const char *filename, char **temp_path) {
+    size_t size = strlen(filename) + 48;
+    char *path = malloc(size);
+    if (!path) return NULL;
+
+    for (int attempt = 0; attempt < 16; attempt++) {
+        unsigned int serial = atomic_fetch_add_explicit(&temp_serial, 1, memory_order_relaxed);
+        snprintf(path, size, "%s.%ld.%u.tmp", filename, (long)getpid(), serial);
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0) {
+            if (errno == EEXIST) continue; // Left behind by an earlier process with this pid
+            break;
+        }
+
+        FILE *file = fdopen(fd, "w");
+        if (!file) {
+            close(fd);
+            remove(path);
+            break;
+        }
+        *temp_path = path;
+        return file;
+    }
+    free(path);
+    return NULL;
+}
+
+// Replace filename with root, or with size bytes of data when root is NULL.
+// The new contents go to a temporary file that is synced before it is renamed
+// over filename, so a failed write or a crash leaves either the old file or
+// the new one. Returns -1 when filename was left alone, and 1 when it was
+// replaced but syncing its directory failed, so the rename may not survive a
+// crash.
+static int replace_file(const char *filename, const TomlTable *root, const char *data, size_t size) {
+    TRACE(save__begin, TOML_TRACE_SAVE, 0, filename, NULL, 0, 0);
+    char *temp_path;
+    FILE *file = create_temp_file(filename, &temp_path);
+    if (!file) {
+        TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, 0, 0);
+        return -1;
+    }
+
+    size_t nodes = 0;
+    if (root) {
+        nodes = write_table_to_file(file, root, 0, NULL);
+    } else if (size > 0) {
+        fwrite(data, 1, size, file);
+    }
+    long position = ftell(file);
+    int write_failed = ferror(file) || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    if (fclose(file) != 0 || write_failed || rename(temp_path, filename) != 0) {
+        remove(temp_path);
+        free(temp_path);
+        TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, 0, 0);
+        return -1;
+    }
+    free(temp_path);
+    TRACE(save__end, TOML_TRACE_SAVE, 1, filename, NULL, position > 0 ? (size_t)position : 0, nodes);
+    return sync_parent(filename) == 0 ? 0 : 1;
+}
+
+int save_file_durable(const TomlTable *root, const char *filename) {
+    if (root && root->doc && root->doc->image) return -1; // Image handles have no tree to write
+    return replace_file(filename, root, NULL, 0);
+}
+
+int write_file_durable(const char *filename, const char *data, size_t size) {
+    return replace_file(filename, NULL, data, size);
+}
+
 void tomlinc_print_table(const TomlTable *table, int indent) {
     static char current_path[1024] = ""; // Static buffer to hold the current path
+    if (table && table->doc && table->doc->image) return; // Image handles have no tree to print
 
     while (table) {
         char full_path[1024] = {0};
@@ -190,37 +365,13 @@ void tomlinc_print_table(const TomlTable *table, int indent) {
     }
 }
 
-char *tomlinc_get_string_value(TomlTable *root_table, const char *table_path, const char *key) {
+char *tomlinc_get_string_value(const TomlTable *root_table, const char *table_path, const char *key) {
     if (!root_table || !table_path || !key) return NULL;
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return NULL;
-    }
-
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
-
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
-
-    if (!current_table) {
-        return NULL;
-    }
-
-    // Search for the key in the found table
-    TomlPair *pair = current_table->pairs;
-    while (pair) {
-        if (strcmp(pair->key, key) == 0) {
-            return (char *)pair->value;
-        }
-        pair = pair->next;
+    TomlValueType type;
+    const void *value = lookup_value(root_table, table_path, key, &type);
+    if (value) {
+        return (char *)value;
     }
 
     return NULL; // Key not found
@@ -231,22 +382,7 @@ int tomlinc_set_string_value(TomlTable *root_table, const char *table_path, cons
         return -1;
     }
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1;
-    }
-
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
-
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         return -1;
@@ -255,11 +391,17 @@ int tomlinc_set_string_value(TomlTable *root_table, const char *table_path, cons
     // Update the key-value pair in the located table
     TomlPair *pair = current_table->pairs;
     while (pair) {
-        if (strcmp(pair->key, key) == 0) {
-            // Free the old value and update with the new one
-            free(pair->value);
-            pair->value = strdup(new_value);
-            return 0; // Successfully updated
+        if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_STRING) {
+            TomlPool *previous = pool_enter(root_table);
+            char *string_value = mem_strdup(new_value);
+            int stored = string_value ? store_pair_value(root_table, current_table, pair, string_value) : -1;
+            pool_leave(previous);
+            if (stored != 0) return -1; // Memory allocation failed
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_SET_VALUE, table_path, key, 0, new_value, TOML_VALUE_STRING);
+            }
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0;
         }
         pair = pair->next;
     }
@@ -267,38 +409,14 @@ int tomlinc_set_string_value(TomlTable *root_table, const char *table_path, cons
     return -1; // Key not found
 }
 
-int tomlinc_get_int_value(TomlTable *root_table, const char *table_path, const char *key, int *result) {
+int tomlinc_get_int_value(const TomlTable *root_table, const char *table_path, const char *key, int *result) {
     if (!root_table || !table_path || !key || !result) return -1;
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1;
-    }
-
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
-
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
-
-    if (!current_table) {
-        return -1;
-    }
-
-    // Update the key-value pair in the located table
-    TomlPair *pair = current_table->pairs;
-    while (pair) {
-        if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_INT) {
-            *result = *(int *)pair->value;
-            return 0; // Successfully retrieved the integer value
-        }
-        pair = pair->next;
+    TomlValueType type;
+    const void *value = lookup_value(root_table, table_path, key, &type);
+    if (value && type == TOML_VALUE_INT) {
+        *result = load_int(value);
+        return 0; // Successfully retrieved the integer value
     }
 
     return -1; // Key not found or not an integer
@@ -307,22 +425,7 @@ int tomlinc_get_int_value(TomlTable *root_table, const char *table_path, const c
 int tomlinc_set_int_value(TomlTable *root_table, const char *table_path, const char *key, int new_value) {
     if (!root_table || !table_path || !key) return -1;
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1;
-    }
-
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
-
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         return -1;
@@ -332,14 +435,13 @@ int tomlinc_set_int_value(TomlTable *root_table, const char *table_path, const c
     TomlPair *pair = current_table->pairs;
     while (pair) {
         if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_INT) {
-            // Update the integer value
-            int *int_value = malloc(sizeof(int));
-            if (!int_value) return -1; // Memory allocation failed
-
-            *int_value = new_value;
-            free(pair->value); // Free the old value
-            pair->value = int_value;
-            return 0; // Successfully updated
+            // Update the integer value in place
+            if (store_scalar_value(root_table, current_table, pair, &new_value) != 0) return -1;
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_SET_VALUE, table_path, key, 0, &new_value, TOML_VALUE_INT);
+            }
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0;
         }
         pair = pair->next;
     }
@@ -347,25 +449,23 @@ int tomlinc_set_int_value(TomlTable *root_table, const char *table_path, const c
     return -1; // Key not found or not an integer
 }
 
-int tomlinc_get_bool_value(TomlTable *root_table, const char *table_path, const char *key, int *result) {
+int tomlinc_get_bool_value(const TomlTable *root_table, const char *table_path, const char *key, int *result) {
     if (!root_table || !table_path || !key || !result) return -1;
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1;
+    TomlValueType type;
+    const void *value = lookup_value(root_table, table_path, key, &type);
+    if (value && type == TOML_VALUE_BOOL) {
+        *result = load_int(value);
+        return 0; // Successfully retrieved the boolean value
     }
 
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
+    return -1; // Key not found or not a boolean
+}
 
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
+int tomlinc_set_bool_value(TomlTable *root_table, const char *table_path, const char *key, int new_value) {
+    if (!root_table || !table_path || !key) return -1;
 
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         return -1;
@@ -375,8 +475,13 @@ int tomlinc_get_bool_value(TomlTable *root_table, const char *table_path, const
     TomlPair *pair = current_table->pairs;
     while (pair) {
         if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_BOOL) {
-            *result = *(int *)pair->value;
-            return 0; // Successfully retrieved the boolean value
+            // Update the boolean value in place
+            if (store_scalar_value(root_table, current_table, pair, &new_value) != 0) return -1;
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_SET_VALUE, table_path, key, 0, &new_value, TOML_VALUE_BOOL);
+            }
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0;
         }
         pair = pair->next;
     }
@@ -384,25 +489,23 @@ int tomlinc_get_bool_value(TomlTable *root_table, const char *table_path, const
     return -1; // Key not found or not a boolean
 }
 
-int tomlinc_set_bool_value(TomlTable *root_table, const char *table_path, const char *key, int new_value) {
-    if (!root_table || !table_path || !key) return -1;
+int tomlinc_get_float_value(const TomlTable *root_table, const char *table_path, const char *key, float *result) {
+    if (!root_table || !table_path || !key || !result) return -1;
 
-    // Tokenize the table path (e.g., "integration.mqtt")
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1;
+    TomlValueType type;
+    const void *value = lookup_value(root_table, table_path, key, &type);
+    if (value && type == TOML_VALUE_FLOAT) {
+        *result = load_float(value);
+        return 0; // Successfully retrieved the float value
     }
 
-    char *token = strtok(path_copy, ".");
-    TomlTable *current_table = root_table;
+    return -1; // Key not found or not a float
+}
 
-    // Traverse the hierarchy
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
+int tomlinc_set_float_value(TomlTable *root_table, const char *table_path, const char *key, float new_value) {
+    if (!root_table || !table_path || !key) return -1;
 
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         return -1;
@@ -411,46 +514,28 @@ int tomlinc_set_bool_value(TomlTable *root_table, const char *table_path, const
     // Update the key-value pair in the located table
     TomlPair *pair = current_table->pairs;
     while (pair) {
-        if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_BOOL) {
-            // Update the boolean value
-            int *bool_value = malloc(sizeof(int));
-            if (!bool_value) return -1; // Memory allocation failed
-
-            *bool_value = new_value;
-            free(pair->value); // Free the old value
-            pair->value = bool_value;
-            return 0; // Successfully updated
+        if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_FLOAT) {
+            // Update the float value in place
+            if (store_scalar_value(root_table, current_table, pair, &new_value) != 0) return -1;
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_SET_VALUE, table_path, key, 0, &new_value, TOML_VALUE_FLOAT);
+            }
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0;
         }
         pair = pair->next;
     }
 
-    return -1; // Key not found or not a boolean
+    return -1; // Key not found or not a float
 }
 
 void *tomlinc_get_array_from_table(const TomlTable *root_table, const char *table_path, const char *key) {
     if (!root_table || !table_path || !key) return NULL;
 
-    char *path_copy = strdup(table_path);
-    if (!path_copy) return NULL;
-
-    char *token = strtok(path_copy, ".");
-    const TomlTable *current_table = root_table;
-
-    while (token && current_table) {
-        current_table = find_table_recursive((TomlTable *)current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
-
-    if (!current_table) return NULL;
-
-    TomlPair *pair = current_table->pairs;
-    while (pair) {
-        if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_ARRAY) {
-            return (void *)pair->value;
-        }
-        pair = pair->next;
+    TomlValueType type;
+    const void *value = lookup_value(root_table, table_path, key, &type);
+    if (value && type == TOML_VALUE_ARRAY) {
+        return (void *)value;
     }
     return NULL;
 }
@@ -460,76 +545,75 @@ int tomlinc_get_array_size(void *array_handle, size_t *size) {
         return -1; // Error: Invalid arguments
     }
 
-    TomlArray *array = (TomlArray *)array_handle;
-    *size = array->count; // Store the size in the provided pointer
+    *size = array_count(array_handle); // Store the size in the provided pointer
     return 0; // Success
 }
 
 int tomlinc_array_value_is_string(void *array_handle, size_t index) {
-    if (!array_handle) return -1;
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count) return -1;
-    return array->types[index] == TOML_VALUE_STRING;
+    TomlValueType type;
+    if (array_element(array_handle, index, &type, NULL, NULL) != 0) return -1;
+    return type == TOML_VALUE_STRING;
 }
 
 int tomlinc_array_value_is_int(void *array_handle, size_t index) {
-    if (!array_handle) return -1;
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count) return -1;
-    return array->types[index] == TOML_VALUE_INT;
+    TomlValueType type;
+    if (array_element(array_handle, index, &type, NULL, NULL) != 0) return -1;
+    return type == TOML_VALUE_INT;
 }
 
 int tomlinc_array_value_is_float(void *array_handle, size_t index) {
-    if (!array_handle) return -1;
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count) return -1;
-    return array->types[index] == TOML_VALUE_FLOAT;
+    TomlValueType type;
+    if (array_element(array_handle, index, &type, NULL, NULL) != 0) return -1;
+    return type == TOML_VALUE_FLOAT;
 }
 
 int tomlinc_array_value_is_bool(void *array_handle, size_t index) {
-    if (!array_handle) return -1;
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count) return -1;
-    return array->types[index] == TOML_VALUE_BOOL;
+    TomlValueType type;
+    if (array_element(array_handle, index, &type, NULL, NULL) != 0) return -1;
+    return type == TOML_VALUE_BOOL;
 }
 
 const char *tomlinc_array_get_string(void *array_handle, size_t index) {
-    if (!array_handle) return NULL;
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count || array->types[index] != TOML_VALUE_STRING) return NULL;
-    return (const char *)array->values[index];
+    TomlValueType type;
+    const void *value;
+    if (array_element(array_handle, index, &type, &value, NULL) != 0 || type != TOML_VALUE_STRING) return NULL;
+    return (const char *)value;
 }
 
 int tomlinc_array_get_int(void *array_handle, size_t index, int *result) {
-    if (!array_handle || !result) return -1; // Invalid arguments
+    if (!result) return -1; // Invalid arguments
 
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count || array->types[index] != TOML_VALUE_INT) return -1; // Out of bounds or wrong type
+    TomlValueType type;
+    const void *value;
+    if (array_element(array_handle, index, &type, &value, NULL) != 0 || type != TOML_VALUE_INT) return -1; // Out of bounds or wrong type
 
-    *result = *(int *)array->values[index]; // Save value to result
+    *result = load_int(value); // Save value to result
     return 0; // Success
 }
 
 int tomlinc_array_get_float(void *array_handle, size_t index, float *result, int *precision) {
-    if (!array_handle || !result) return -1; // Invalid arguments
+    if (!result) return -1; // Invalid arguments
 
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count || array->types[index] != TOML_VALUE_FLOAT) return -1; // Out of bounds or wrong type
+    TomlValueType type;
+    const void *value;
+    size_t value_precision;
+    if (array_element(array_handle, index, &type, &value, &value_precision) != 0 || type != TOML_VALUE_FLOAT) return -1; // Out of bounds or wrong type
 
-    *result = *(float *)array->values[index]; // Save value to result
+    *result = load_float(value); // Save value to result
     if (precision) {
-        *precision = array->float_precisions[index]; // Save precision if requested
+        *precision = (int)value_precision; // Save precision if requested
     }
     return 0; // Success
 }
 
 int tomlinc_array_get_bool(void *array_handle, size_t index, int *result) {
-    if (!array_handle || !result) return -1; // Invalid arguments
+    if (!result) return -1; // Invalid arguments
 
-    TomlArray *array = (TomlArray *)array_handle;
-    if (index >= array->count || array->types[index] != TOML_VALUE_BOOL) return -1; // Out of bounds or wrong type
+    TomlValueType type;
+    const void *value;
+    if (array_element(array_handle, index, &type, &value, NULL) != 0 || type != TOML_VALUE_BOOL) return -1; // Out of bounds or wrong type
 
-    *result = *(int *)array->values[index]; // Save value to result
+    *result = load_int(value); // Save value to result
     return 0; // Success
 }
 
@@ -539,19 +623,7 @@ int tomlinc_array_set_value(TomlTable *root_table, const char *table_path, const
     }
 
     // Find the target table
-    TomlTable *current_table = root_table;
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        return -1; // Memory allocation failed
-    }
-
-    char *token = strtok(path_copy, ".");
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         return -1; // Table not found
@@ -561,49 +633,25 @@ int tomlinc_array_set_value(TomlTable *root_table, const char *table_path, const
     TomlPair *pair = current_table->pairs;
     while (pair) {
         if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_ARRAY) {
-            TomlArray *array = (TomlArray *)pair->value;
-
-            if (index >= array->count) {
-                return -1; // Index out of bounds
+            size_t precision = value_type == TOML_VALUE_FLOAT ? float_precision(*(float *)new_value) : 0;
+            int stored;
+            TomlPool *previous = pool_enter(root_table);
+            if (value_type != TOML_VALUE_STRING) {
+                // Scalars of the same type are overwritten in place
+                stored = store_array_scalar(root_table, current_table, pair, index, new_value, value_type, precision);
+            } else {
+                void *new_entry = copy_value(new_value, value_type);
+                stored = new_entry ? store_array_value(root_table, current_table, pair, index, new_entry, value_type, precision) : -1;
             }
-
-            // Free the old value
-            if (array->types[index] == TOML_VALUE_STRING) {
-                free(array->values[index]);
-            } else if (array->types[index] == TOML_VALUE_ARRAY) {
-                free_array((TomlArray *)array->values[index]);
+            pool_leave(previous);
+            if (stored != 0) {
+                return -1; // Out of bounds, unsupported type or memory allocation failed
             }
-
-            // Update the value based on the provided value_type
-            void *new_entry = NULL;
-            switch (value_type) {
-                case TOML_VALUE_STRING:
-                    new_entry = strdup((char *)new_value);
-                    break;
-                case TOML_VALUE_INT:
-                    new_entry = malloc(sizeof(int));
-                    if (new_entry) *(int *)new_entry = *(int *)new_value;
-                    break;
-                case TOML_VALUE_FLOAT:
-                    new_entry = malloc(sizeof(float));
-                    if (new_entry) *(float *)new_entry = *(float *)new_value;
-                    break;
-                case TOML_VALUE_BOOL:
-                    new_entry = malloc(sizeof(int)); // Booleans stored as integers
-                    if (new_entry) *(int *)new_entry = *(int *)new_value;
-                    break;
-                default:
-                    return -1; // Unsupported type
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_ARRAY_SET, table_path, key, index, new_value, value_type);
             }
-
-            if (!new_entry) {
-                return -1; // Memory allocation failed
-            }
-
-            // Update the array
-            array->values[index] = new_entry;
-            array->types[index] = value_type; // Update the type
-            return 0; // Successfully updated
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0;
         }
         pair = pair->next;
     }
@@ -618,20 +666,7 @@ int tomlinc_array_add_value(TomlTable *root_table, const char *table_path, const
     }
 
     // Find the target table
-    TomlTable *current_table = root_table;
-    char *path_copy = strdup(table_path);
-    if (!path_copy) {
-        fprintf(stderr, "DEBUG: Memory allocation failed for path_copy.\n");
-        return -1; // Memory allocation failed
-    }
-
-    char *token = strtok(path_copy, ".");
-    while (token && current_table) {
-        current_table = find_table_recursive(current_table, token);
-        token = strtok(NULL, ".");
-    }
-
-    free(path_copy);
+    TomlTable *current_table = resolve_table_path_for_write(root_table, table_path);
 
     if (!current_table) {
         fprintf(stderr, "DEBUG: Table '%s' not found.\n", table_path);
@@ -642,91 +677,191 @@ int tomlinc_array_add_value(TomlTable *root_table, const char *table_path, const
     TomlPair *pair = current_table->pairs;
     while (pair) {
         if (strcmp(pair->key, key) == 0 && pair->type == TOML_VALUE_ARRAY) {
-            TomlArray *array = (TomlArray *)pair->value;
-
-            // Extend the array
-            void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-            TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-            size_t *new_precisions = NULL;
-
-            if (value_type == TOML_VALUE_FLOAT) {
-                new_precisions = realloc(array->float_precisions, sizeof(size_t) * (array->count + 1));
-                if (!new_precisions) {
-                    fprintf(stderr, "DEBUG: Memory allocation failed for float_precisions.\n");
-                    free(new_values);
-                    free(new_types);
-                    return -1; // Memory allocation failed for precision
-                }
-                array->float_precisions = new_precisions;
+            TomlPool *previous = pool_enter(root_table);
+            void *new_entry = copy_value(new_value, value_type);
+            if (!new_entry) {
+                pool_leave(previous);
+                fprintf(stderr, "DEBUG: Unsupported type or memory allocation failed for the new value.\n");
+                return -1; // Unsupported type or memory allocation failed
             }
 
-            if (!new_values || !new_types) {
+            size_t precision = value_type == TOML_VALUE_FLOAT ? float_precision(*(float *)new_value) : 0;
+            TomlTxn *txn = root_table->doc ? root_table->doc->txn : NULL;
+            size_t index = txn ? txn_array_count(txn, pair) : ((TomlArray *)pair->value)->count;
+            int appended = append_array_value(root_table, current_table, pair, new_entry, value_type, precision);
+            pool_leave(previous);
+            if (appended != 0) {
                 fprintf(stderr, "DEBUG: Memory allocation failed for array values or types.\n");
-                if (new_values) free(new_values);
-                if (new_types) free(new_types);
                 return -1; // Memory allocation failed
             }
-
-            array->values = new_values;
-            array->types = new_types;
-
-            // Add the new value based on its type
-            void *new_entry = NULL;
-            switch (value_type) {
-                case TOML_VALUE_STRING:
-                    new_entry = strdup((char *)new_value);
-                    break;
-                case TOML_VALUE_INT:
-                    new_entry = malloc(sizeof(int));
-                    if (new_entry) {
-                        *(int *)new_entry = *(int *)new_value;
-                    }
-                    break;
-                case TOML_VALUE_FLOAT: {
-                    new_entry = malloc(sizeof(float));
-                    if (new_entry) {
-                        *(float *)new_entry = *(float *)new_value;
-
-                        // Calculate and store precision
-                        char buffer[32];
-                        snprintf(buffer, sizeof(buffer), "%.10f", *(float *)new_value);
-                        char *dot = strchr(buffer, '.');
-                        if (dot) {
-                            array->float_precisions[array->count] = strlen(dot + 1);
-                        } else {
-                            array->float_precisions[array->count] = 0; // No precision
-                        }
-                    }
-                    break;
-                }
-                case TOML_VALUE_BOOL:
-                    new_entry = malloc(sizeof(int));
-                    if (new_entry) {
-                        *(int *)new_entry = *(int *)new_value;
-                    }
-                    break;
-                default:
-                    return -1; // Unsupported type
+            if (root_table->doc && root_table->doc->journal) {
+                journal_record(root_table, TXN_ARRAY_ADD, table_path, key, index, new_value, value_type);
             }
+            if (root_table->doc && root_table->doc->subscriptions) subscriptions_notify(root_table, table_path, key);
+            return 0; // Successfully added
+        }
+        pair = pair->next;
+    }
 
-            if (!new_entry) {
-                return -1; // Memory allocation failed
-            }
+    fprintf(stderr, "DEBUG: Key '%s' not found or not an array.\n", key);
+    return -1; // Key not found or not an array
+}
 
-            array->values[array->count] = new_entry;
-            array->types[array->count] = value_type;
+const TomlTable *tomlinc_get_table(const TomlTable *root_table, const char *table_path) {
+    if (!root_table || !table_path) return NULL;
+    return resolve_table_path(root_table, table_path);
+}
+
+const char *tomlinc_table_name(const TomlTable *table) {
+    if (!table) return NULL;
+    return table->name;
+}
+
+int tomlinc_table_is_array_of_tables(const TomlTable *table) {
+    if (!table) return -1;
+    return table->is_array_container;
+}
+
+int tomlinc_aot_count(const TomlTable *root_table, const char *table_path, size_t *count) {
+    if (!root_table || !table_path || !count) return -1;
+
+    const TomlTable *container = resolve_table_path(root_table, table_path);
+    if (!container || !container->is_array_container) return -1;
+
+    if (container->elements) {
+        *count = container->element_count;
+    } else {
+        *count = 0;
+        for (const TomlTable *element = container->array_of_tables; element; element = element->next) {
+            (*count)++;
+        }
+    }
+    return 0;
+}
+
+const TomlTable *tomlinc_aot_get(const TomlTable *root_table, const char *table_path, size_t index) {
+    if (!root_table || !table_path) return NULL;
+
+    const TomlTable *container = resolve_table_path(root_table, table_path);
+    if (!container || !container->is_array_container) return NULL;
+
+    return aot_element(container, index);
+}
+
+void tomlinc_iter_tables(const TomlTable *root_table, TomlIter *iter) {
+    if (!iter) return;
+    // Top-level tables are the root and its siblings, image handles have none
+    iter->next = root_table && root_table->doc && root_table->doc->image ? NULL : root_table;
+}
+
+void tomlinc_iter_subtables(const TomlTable *table, TomlIter *iter) {
+    if (!iter) return;
+    iter->next = table ? table->subtables : NULL;
+}
+
+void tomlinc_iter_array_of_tables(const TomlTable *table, TomlIter *iter) {
+    if (!iter) return;
+    iter->next = table ? table->array_of_tables : NULL;
+}
+
+const TomlTable *tomlinc_iter_next_table(TomlIter *iter) {
+    if (!iter || !iter->next) return NULL;
+
+    const TomlTable *table = (const TomlTable *)iter->next;
+    iter->next = table->next;
+    return table;
+}
+
+void tomlinc_iter_pairs(const TomlTable *table, TomlIter *iter) {
+    if (!iter) return;
+    iter->next = table ? table->pairs : NULL;
+}
+
+int tomlinc_iter_next_pair(TomlIter *iter, TomlPairEntry *entry) {
+    if (!iter || !entry || !iter->next) return -1; // Invalid arguments or end of table
+
+    const TomlPair *pair = (const TomlPair *)iter->next;
+    iter->next = pair->next;
+
+    fill_pair_entry(entry, pair);
+    return 0;
+}
+
+static int compare_query_paths(const void *a, const void *b) {
+    const TomlQuery *query_a = *(const TomlQuery *const *)a;
+    const TomlQuery *query_b = *(const TomlQuery *const *)b;
+    return strcmp(query_a->table_path, query_b->table_path);
+}
+
+static int fill_query_result(const void *value, TomlValueType type, const TomlQuery *query) {
+    if (!value || type != query->type) return -1;
+
+    switch (query->type) {
+        case TOML_VALUE_STRING:
+            *(const char **)query->result = (const char *)value;
+            break;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL:
+            *(int *)query->result = load_int(value);
+            break;
+        case TOML_VALUE_FLOAT:
+            *(float *)query->result = load_float(value);
+            break;
+        case TOML_VALUE_ARRAY:
+            *(void **)query->result = (void *)value;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+// Returns the number of queries that were not found (0 when all were filled),
+// or -1 on invalid arguments
+int tomlinc_get_batch(const TomlTable *root_table, const TomlQuery *queries, size_t count) {
+    if (!root_table || (!queries && count > 0)) return -1;
 
-            // Ensure precision array is initialized correctly for non-float types
-            if (value_type != TOML_VALUE_FLOAT && array->float_precisions) {
-                array->float_precisions[array->count] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!queries[i].table_path || !queries[i].key || !queries[i].result) return -1;
+    }
+
+    // Group the queries by table path so each distinct table is resolved once
+    const TomlQuery *stack_order[64];
+    const TomlQuery **order = stack_order;
+    if (count > sizeof(stack_order) / sizeof(stack_order[0])) {
+        order = malloc(sizeof(*order) * count);
+        if (!order) return -1; // Memory allocation failed
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = &queries[i];
+    }
+    qsort(order, count, sizeof(*order), compare_query_paths);
+
+    int missing = 0;
+    int is_tree = !root_table->doc || (!root_table->doc->overlay && !root_table->doc->image);
+    const TomlTable *current_table = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const void *value = NULL;
+        TomlValueType type = TOML_VALUE_INT;
+        if (!is_tree) {
+            // Overlays and images have their own lookup
+            value = lookup_value(root_table, order[i]->table_path, order[i]->key, &type);
+        } else {
+            if (i == 0 || strcmp(order[i]->table_path, order[i - 1]->table_path) != 0) {
+                current_table = resolve_table_path(root_table, order[i]->table_path);
             }
+            const TomlPair *pair = current_table ? find_pair(current_table, order[i]->key) : NULL;
+            if (pair) {
+                value = pair->value;
+                type = pair->type;
+            }
+        }
 
-            array->count++; // Increment the count
-            return 0; // Successfully added
+        if (fill_query_result(value, type, order[i]) != 0) {
+            missing++;
         }
-        pair = pair->next;
     }
 
-    fprintf(stderr, "DEBUG: Key '%s' not found or not an array.\n", key);
-    return -1; // Key not found or not an array
+    if (order != stack_order) free(order);
+    return missing;
 }
@@ -0,0 +1,207 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Debounced background saving. An applied change only marks the document
+// dirty and wakes the writer thread. Once the changes have settled, the writer
+// takes one snapshot by writing the document out to memory, then saves that
+// durably (save_file_durable) while the caller goes on.
+//
+// The mutation entry points change the tree between autosave_lock and
+// autosave_unlock, so the snapshot never sees half a change. The writer holds
+// the lock only while it copies the document into memory, never during I/O.
+
+// Under a steady stream of changes, save at least this many debounce periods
+// after the first unsaved change
+#define AUTOSAVE_MAX_DELAY_FACTOR 8
+
+struct TomlAutosave {
+    pthread_t thread;
+    pthread_mutex_t lock;    // Held by the setters while they change the tree
+    pthread_cond_t changed;  // Signalled on changes and on stop
+    pthread_cond_t idle;     // Signalled when the writer has nothing left to write
+
+    const TomlTable *root;
+    char *path;
+    uint64_t debounce_ns;
+
+    // Protected by lock
+    int dirty;               // Changed since the last snapshot
+    uint64_t first_change;   // Time of the oldest unsaved change
+    uint64_t last_change;
+    int writing;
+    int flushing;            // Skip the debounce for what is pending now
+    int stopping;
+    int failed;              // A snapshot or save failed since the last flush
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static struct timespec to_timespec(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000u);
+    ts.tv_nsec = (long)(ns % 1000000000u);
+    return ts;
+}
+
+// Write the document out to memory, called with lock held
+static int take_snapshot(const TomlAutosave *autosave, char **data, size_t *size) {
+    FILE *memory = open_memstream(data, size);
+    if (!memory) return -1;
+
+    write_table_to_file(memory, autosave->root, 0, NULL);
+    int write_failed = ferror(memory);
+    if (fclose(memory) != 0 || write_failed) {
+        free(*data);
+        return -1;
+    }
+    return 0;
+}
+
+static void *autosave_thread(void *arg) {
+    TomlAutosave *autosave = (TomlAutosave *)arg;
+
+    pthread_mutex_lock(&autosave->lock);
+    for (;;) {
+        if (!autosave->dirty) {
+            if (autosave->stopping) break;
+            pthread_cond_wait(&autosave->changed, &autosave->lock);
+            continue;
+        }
+
+        // Wait for the changes to settle, unless stopping or they kept coming for too long
+        uint64_t deadline = autosave->last_change + autosave->debounce_ns;
+        uint64_t latest = autosave->first_change + autosave->debounce_ns * AUTOSAVE_MAX_DELAY_FACTOR;
+        if (latest < deadline) deadline = latest;
+        if (!autosave->stopping && !autosave->flushing && now_ns() < deadline) {
+            struct timespec ts = to_timespec(deadline);
+            pthread_cond_timedwait(&autosave->changed, &autosave->lock, &ts);
+            continue;
+        }
+
+        char *data = NULL;
+        size_t size = 0;
+        int result = take_snapshot(autosave, &data, &size);
+        autosave->dirty = 0;
+        autosave->writing = 1;
+        pthread_mutex_unlock(&autosave->lock);
+
+        if (result == 0) {
+            result = write_file_durable(autosave->path, data, size);
+            free(data);
+        }
+
+        pthread_mutex_lock(&autosave->lock);
+        autosave->writing = 0;
+        if (result != 0) autosave->failed = 1;
+        if (!autosave->dirty) pthread_cond_broadcast(&autosave->idle);
+    }
+    pthread_mutex_unlock(&autosave->lock);
+    return NULL;
+}
+
+// Called by the mutation entry points before they change the tree
+void autosave_lock(TomlTable *root) {
+    if (root->doc && root->doc->autosave) pthread_mutex_lock(&root->doc->autosave->lock);
+}
+
+// ...and after, with changed set when something was applied
+void autosave_unlock(TomlTable *root, int changed) {
+    if (!root->doc || !root->doc->autosave) return;
+    TomlAutosave *autosave = root->doc->autosave;
+
+    if (changed) {
+        uint64_t now = now_ns();
+        if (!autosave->dirty) autosave->first_change = now;
+        autosave->last_change = now;
+        autosave->dirty = 1;
+        pthread_cond_signal(&autosave->changed);
+    }
+    pthread_mutex_unlock(&autosave->lock);
+}
+
+int tomlinc_autosave_start(TomlTable *root_table, const char *path, unsigned int debounce_ms) {
+    if (!root_table || !path || !root_table->doc) return -1;
+    if (root_table->doc->overlay || root_table->doc->image || root_table->doc->pool) return -1;
+    if (root_table->doc->autosave) return -1; // Already running
+
+    TomlAutosave *autosave = calloc(1, sizeof(TomlAutosave));
+    if (!autosave) return -1;
+
+    autosave->root = root_table;
+    autosave->path = strdup(path);
+    if (!autosave->path) goto fail_alloc;
+    autosave->debounce_ns = (uint64_t)debounce_ms * 1000000u;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // Deadlines come from now_ns
+    pthread_mutex_init(&autosave->lock, NULL);
+    pthread_cond_init(&autosave->changed, &attr);
+    pthread_cond_init(&autosave->idle, NULL);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&autosave->thread, NULL, autosave_thread, autosave) != 0) {
+        pthread_cond_destroy(&autosave->idle);
+        pthread_cond_destroy(&autosave->changed);
+        pthread_mutex_destroy(&autosave->lock);
+        goto fail_alloc;
+    }
+
+    root_table->doc->autosave = autosave;
+    return 0;
+
+fail_alloc:
+    free(autosave->path);
+    free(autosave);
+    return -1;
+}
+
+// Wait until every change made so far is on disk, without waiting for the debounce
+int tomlinc_autosave_flush(TomlTable *root_table) {
+    if (!root_table || !root_table->doc || !root_table->doc->autosave) return -1;
+    TomlAutosave *autosave = root_table->doc->autosave;
+
+    pthread_mutex_lock(&autosave->lock);
+    autosave->flushing = 1;
+    pthread_cond_signal(&autosave->changed);
+    while (autosave->dirty || autosave->writing) {
+        pthread_cond_wait(&autosave->idle, &autosave->lock);
+    }
+    autosave->flushing = 0;
+    int result = autosave->failed ? -1 : 0;
+    autosave->failed = 0;
+    pthread_mutex_unlock(&autosave->lock);
+    return result;
+}
+
+// Write out the pending changes and stop the writer thread. Returns -1 when a
+// save failed since the last flush.
+int tomlinc_autosave_stop(TomlTable *root_table) {
+    if (!root_table || !root_table->doc || !root_table->doc->autosave) return -1;
+    TomlAutosave *autosave = root_table->doc->autosave;
+
+    pthread_mutex_lock(&autosave->lock);
+    autosave->stopping = 1;
+    pthread_cond_signal(&autosave->changed);
+    pthread_mutex_unlock(&autosave->lock);
+    pthread_join(autosave->thread, NULL);
+
+    int result = autosave->failed ? -1 : 0;
+    pthread_cond_destroy(&autosave->idle);
+    pthread_cond_destroy(&autosave->changed);
+    pthread_mutex_destroy(&autosave->lock);
+    free(autosave->path);
+    free(autosave);
+
+    root_table->doc->autosave = NULL;
+    return result;
+}
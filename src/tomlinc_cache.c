@@ -0,0 +1,132 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Lookup cache for the getters. A small direct-mapped table maps the hash of
+// a (table_path, key) pair to the TomlPair it resolved to, so repeated getter
+// calls skip the table walk and the pair scan. Slots keep the table path
+// itself and hits compare it along with the key, so two lookups whose hashes
+// collide never get each other's pair; longer paths are not cached.
+//
+// Values are read from the pair on every call and setters change them in
+// place, so entries only go stale when nodes are replaced. That happens when
+// a forked document copies shared nodes, which bumps the document's layout
+// counter; entries filled under an older layout are ignored.
+//
+// Getters may run on many threads at once, and each of them may fill slots.
+// Every slot is a small seqlock: a reader takes an entry only when the
+// sequence was even and unchanged around its reads, a filler that finds the
+// slot busy simply skips caching.
+
+#define LOOKUP_CACHE_SLOTS 256     // Power of two
+#define LOOKUP_CACHE_PATH_WORDS 8  // Table paths up to 63 bytes are cached
+
+// A table path padded with zeros to whole words. The last word holds the
+// terminator, so comparing the first count words compares the strings.
+typedef struct {
+    uint64_t words[LOOKUP_CACHE_PATH_WORDS];
+    size_t count;
+} CachePath;
+
+typedef struct {
+    _Atomic uint32_t sequence; // Odd while being filled
+    _Atomic uint64_t hash;
+    _Atomic uint64_t layout;
+    TomlPair *_Atomic pair;
+    _Atomic uint64_t path[LOOKUP_CACHE_PATH_WORDS];
+} CacheSlot;
+
+struct TomlLookupCache {
+    CacheSlot slots[LOOKUP_CACHE_SLOTS];
+};
+
+static uint64_t lookup_hash(const char *table_path, const char *key) {
+    return hash_string(hash_string(0, table_path), key);
+}
+
+static int pack_path(const char *table_path, CachePath *out) {
+    size_t len = strlen(table_path);
+    if (len >= sizeof(out->words)) return -1;
+
+    out->count = len / sizeof(uint64_t) + 1;
+    out->words[out->count - 1] = 0;
+    memcpy(out->words, table_path, len);
+    return 0;
+}
+
+static TomlLookupCache *document_cache(TomlDocument *doc) {
+    TomlLookupCache *cache = atomic_load_explicit(&doc->cache, memory_order_acquire);
+    if (cache) return cache;
+
+    cache = calloc(1, sizeof(TomlLookupCache));
+    if (!cache) return NULL;
+
+    // Another getter may have got there first
+    TomlLookupCache *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&doc->cache, &expected, cache, memory_order_acq_rel, memory_order_acquire)) {
+        free(cache);
+        cache = expected;
+    }
+    return cache;
+}
+
+static const TomlPair *slot_read(CacheSlot *slot, uint64_t hash, uint64_t layout, const CachePath *path, const char *key) {
+    uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence & 1) return NULL;
+
+    uint64_t slot_hash = atomic_load_explicit(&slot->hash, memory_order_relaxed);
+    uint64_t slot_layout = atomic_load_explicit(&slot->layout, memory_order_relaxed);
+    const TomlPair *pair = atomic_load_explicit(&slot->pair, memory_order_relaxed);
+    if (slot_hash != hash) return NULL;
+    for (size_t i = 0; i < path->count; i++) {
+        if (atomic_load_explicit(&slot->path[i], memory_order_relaxed) != path->words[i]) return NULL;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence) return NULL;
+
+    if (!pair || slot_layout != layout) return NULL;
+    return strcmp(pair->key, key) == 0 ? pair : NULL; // Keys with the same hash
+}
+
+static void slot_write(CacheSlot *slot, uint64_t hash, uint64_t layout, const CachePath *path, const TomlPair *pair) {
+    uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    if (sequence & 1) return;
+    if (!atomic_compare_exchange_strong_explicit(&slot->sequence, &sequence, sequence + 1, memory_order_relaxed, memory_order_relaxed)) {
+        return; // Another thread is filling it
+    }
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&slot->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&slot->layout, layout, memory_order_relaxed);
+    atomic_store_explicit(&slot->pair, (TomlPair *)pair, memory_order_relaxed);
+    for (size_t i = 0; i < path->count; i++) {
+        atomic_store_explicit(&slot->path[i], path->words[i], memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+}
+
+// find_pair(resolve_table_path(root, table_path), key), cached per document
+const TomlPair *cache_find_pair(const TomlTable *root, const char *table_path, const char *key) {
+    CachePath path;
+    TomlLookupCache *cache = pack_path(table_path, &path) == 0 ? document_cache(root->doc) : NULL;
+    uint64_t layout = atomic_load_explicit(&root->doc->layout, memory_order_acquire);
+    uint64_t hash = lookup_hash(table_path, key);
+    CacheSlot *slot = cache ? &cache->slots[hash & (LOOKUP_CACHE_SLOTS - 1)] : NULL;
+
+    if (slot) {
+        const TomlPair *pair = slot_read(slot, hash, layout, &path, key);
+        if (pair) return pair;
+    }
+
+    const TomlTable *table = resolve_table_path(root, table_path);
+    const TomlPair *pair = table ? find_pair(table, key) : NULL;
+    if (pair && slot) slot_write(slot, hash, layout, &path, pair); // Misses are not cached
+    return pair;
+}
+
+void cache_free(TomlDocument *doc) {
+    free(atomic_load_explicit(&doc->cache, memory_order_relaxed));
+}
@@ -0,0 +1,266 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Copy-on-write document forks.
+//
+// Tables, pairs and arrays carry a "shares" count of owners beyond the first.
+// An owner is an incoming link: a document handle, a parent's subtables/pairs
+// head or a predecessor's next pointer. tomlinc_fork only copies the root node
+// and bumps the counts of what it links to. Before a setter writes, the links
+// it walked from the root are made exclusive by copying every shared node on
+// the way, so the other documents never see the change.
+
+enum {
+    STEP_CHILD,
+    STEP_NEXT
+};
+
+typedef struct {
+    unsigned char *steps;
+    size_t count;
+    size_t capacity;
+    int failed;
+} StepList;
+
+static void push_step(StepList *list, unsigned char step) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 32;
+        unsigned char *new_steps = realloc(list->steps, new_capacity);
+        if (!new_steps) {
+            list->failed = 1;
+            return;
+        }
+        list->steps = new_steps;
+        list->capacity = new_capacity;
+    }
+    list->steps[list->count++] = step;
+}
+
+// Same search as find_table_recursive_n, recording the steps taken from the start node
+static TomlTable *find_table_steps(TomlTable *table, const char *name, size_t len, StepList *list) {
+    size_t start = list->count;
+
+    while (table) {
+        if (strncmp(table->name, name, len) == 0 && table->name[len] == '\0') {
+            return table;
+        }
+
+        if (table->subtables) {
+            size_t mark = list->count;
+            push_step(list, STEP_CHILD);
+            TomlTable *found = find_table_steps(table->subtables, name, len, list);
+            if (found) return found;
+            list->count = mark;
+        }
+
+        push_step(list, STEP_NEXT);
+        table = table->next;
+    }
+
+    list->count = start;
+    return NULL;
+}
+
+static TomlTable *copy_table_node(const TomlTable *table) {
+    TomlTable *copy = malloc(sizeof(TomlTable));
+    if (!copy) return NULL;
+
+    *copy = *table;
+    copy->name = strdup(table->name);
+    if (!copy->name) {
+        free(copy);
+        return NULL;
+    }
+    copy->doc = NULL;
+    copy->shares = 0;
+    copy->indexes = NULL; // Indexes follow their document, see refresh_index
+
+    // The element vector belongs to its container, the elements themselves are shared
+    if (table->elements) {
+        copy->elements = malloc(sizeof(TomlTable *) * table->element_count);
+        if (!copy->elements) {
+            free(copy->name);
+            free(copy);
+            return NULL;
+        }
+        memcpy(copy->elements, table->elements, sizeof(TomlTable *) * table->element_count);
+        copy->element_capacity = table->element_count;
+    }
+
+    // The copy links to the same children and successor, which gain an owner
+    if (copy->pairs) copy->pairs->shares++;
+    if (copy->subtables) copy->subtables->shares++;
+    if (copy->array_of_tables) copy->array_of_tables->shares++;
+    if (copy->next) copy->next->shares++;
+    return copy;
+}
+
+static TomlPair *copy_pair_node(const TomlPair *pair) {
+    TomlPair *copy = malloc(sizeof(TomlPair));
+    if (!copy) return NULL;
+
+    *copy = *pair;
+    copy->shares = 0;
+    copy->key = strdup(pair->key);
+    if (pair->type == TOML_VALUE_ARRAY) {
+        ((TomlArray *)pair->value)->shares++; // Arrays stay shared until written
+    } else {
+        copy->value = copy_value(pair->value, pair->type);
+    }
+    if (!copy->key || !copy->value) {
+        if (pair->type == TOML_VALUE_ARRAY) {
+            ((TomlArray *)pair->value)->shares--;
+        } else {
+            free(copy->value);
+        }
+        free(copy->key);
+        free(copy);
+        return NULL;
+    }
+
+    if (copy->next) copy->next->shares++;
+    return copy;
+}
+
+static TomlArray *copy_array(const TomlArray *array) {
+    TomlArray *copy = calloc(1, sizeof(TomlArray));
+    if (!copy) return NULL;
+
+    if (array_reserve(copy, array->count) != 0) {
+        free_array(copy);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < array->count; i++) {
+        TomlValueType type = array->types[i];
+        void *value = type == TOML_VALUE_ARRAY ? copy_array((const TomlArray *)array->values[i])
+                                               : copy_value(array->values[i], type);
+        if (!value) {
+            free_array(copy);
+            return NULL;
+        }
+        copy->values[i] = value;
+        copy->types[i] = type;
+        // The source precision array may be shorter than count, only float slots are valid
+        copy->float_precisions[i] = type == TOML_VALUE_FLOAT ? array->float_precisions[i] : 0;
+        copy->count++;
+    }
+    return copy;
+}
+
+// Replay the steps from the root, copying shared nodes so that the final table
+// and every link leading to it belong to this document only
+static TomlTable *unshare_steps(TomlTable *root, const StepList *list) {
+    TomlTable *table = root; // The root node is owned by the document handle
+    TomlTable *parent = NULL;
+
+    for (size_t i = 0; i < list->count; i++) {
+        TomlTable **link;
+        if (list->steps[i] == STEP_CHILD) {
+            parent = table;
+            link = &table->subtables;
+        } else {
+            link = &table->next;
+        }
+
+        TomlTable *next = *link;
+        if (next->shares > 0) {
+            TomlTable *copy = copy_table_node(next);
+            if (!copy) return NULL;
+            next->shares--;
+            *link = copy;
+            next = copy;
+            root->doc->layout++; // Cached lookups may point below the old node
+        }
+        // Parent links of shared nodes may point into another document
+        next->parent = parent;
+        table = next;
+    }
+    return table;
+}
+
+TomlTable *resolve_table_path_for_write(TomlTable *root, const char *table_path) {
+    if (!root->doc || !root->doc->forked) {
+        return resolve_table_path(root, table_path);
+    }
+    if (strchr(table_path, '[')) return NULL; // Elements are not copied on write
+
+    StepList list = {0};
+    TomlTable *current_table = root;
+    const char *token = table_path;
+
+    while (current_table && *token) {
+        if (*token == '.') {
+            token++;
+            continue;
+        }
+        size_t len = strcspn(token, ".");
+        current_table = find_table_steps(current_table, token, len, &list);
+        token += len;
+    }
+
+    if (current_table && !list.failed) {
+        current_table = unshare_steps(root, &list);
+    } else {
+        current_table = NULL;
+    }
+
+    free(list.steps);
+    return current_table;
+}
+
+// Make a pair of an exclusively owned table (and its array, if any) exclusive too
+TomlPair *unshare_pair(TomlTable *root, TomlTable *table, TomlPair *pair) {
+    if (!root->doc || !root->doc->forked) return pair;
+
+    TomlPair **link = &table->pairs;
+    while (*link && *link != pair) {
+        if ((*link)->shares > 0) {
+            TomlPair *copy = copy_pair_node(*link);
+            if (!copy) return NULL;
+            (*link)->shares--;
+            *link = copy;
+            root->doc->layout++;
+        }
+        link = &(*link)->next;
+    }
+    if (!*link) return NULL; // Not a pair of this table
+
+    if (pair->shares > 0) {
+        TomlPair *copy = copy_pair_node(pair);
+        if (!copy) return NULL;
+        pair->shares--;
+        *link = copy;
+        pair = copy;
+        root->doc->layout++;
+    }
+
+    if (pair->type == TOML_VALUE_ARRAY && ((TomlArray *)pair->value)->shares > 0) {
+        TomlArray *copy = copy_array((TomlArray *)pair->value);
+        if (!copy) return NULL;
+        ((TomlArray *)pair->value)->shares--;
+        pair->value = copy;
+    }
+    return pair;
+}
+
+TomlTable *tomlinc_fork(TomlTable *root_table) {
+    if (!root_table || !root_table->doc || root_table->doc->overlay || root_table->doc->image || root_table->doc->pool) return NULL;
+    if (root_table->doc->txn) return NULL; // Staged changes hold pointers into the tree
+
+    TomlTable *copy = copy_table_node(root_table);
+    if (!copy) return NULL;
+
+    copy->doc = calloc(1, sizeof(TomlDocument));
+    if (!copy->doc) {
+        free_tables(copy);
+        return NULL;
+    }
+
+    root_table->doc->forked = 1;
+    copy->doc->forked = 1;
+    return copy;
+}
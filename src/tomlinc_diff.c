@@ -0,0 +1,135 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Structural diff that only descends into subtrees whose fingerprints differ,
+// so the cost is proportional to what changed rather than to the document size.
+
+typedef struct {
+    TomlDiffCallback callback;
+    void *userdata;
+    char path[1024];
+} DiffContext;
+
+static int diff_tables(DiffContext *ctx, const TomlTable *old_list, const TomlTable *new_list);
+
+// Append ".name" (or "[index]" for array-of-tables elements) to the current path
+static int push_path(DiffContext *ctx, const char *name, size_t index, int is_element, size_t *saved_len) {
+    size_t len = strlen(ctx->path);
+    size_t room = sizeof(ctx->path) - len;
+    int written;
+
+    if (is_element) {
+        written = snprintf(ctx->path + len, room, "[%zu]", index);
+    } else {
+        written = snprintf(ctx->path + len, room, "%s%s", len ? "." : "", name);
+    }
+
+    *saved_len = len;
+    if (written < 0 || (size_t)written >= room) {
+        fprintf(stderr, "Path too long, truncating: %s\n", ctx->path);
+        ctx->path[len] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+static void diff_pairs(DiffContext *ctx, const TomlTable *old_table, const TomlTable *new_table) {
+    for (const TomlPair *old_pair = old_table->pairs; old_pair; old_pair = old_pair->next) {
+        const TomlPair *new_pair = find_pair(new_table, old_pair->key);
+        if (!new_pair) {
+            ctx->callback(ctx->path, old_pair->key, TOML_DIFF_REMOVED, ctx->userdata);
+        } else if (!values_equal(old_pair->value, old_pair->type, new_pair->value, new_pair->type)) {
+            ctx->callback(ctx->path, old_pair->key, TOML_DIFF_CHANGED, ctx->userdata);
+        }
+    }
+
+    for (const TomlPair *new_pair = new_table->pairs; new_pair; new_pair = new_pair->next) {
+        if (!find_pair(old_table, new_pair->key)) {
+            ctx->callback(ctx->path, new_pair->key, TOML_DIFF_ADDED, ctx->userdata);
+        }
+    }
+}
+
+// Both tables exist at the current path and their hashes differ
+static int diff_table_contents(DiffContext *ctx, const TomlTable *old_table, const TomlTable *new_table) {
+    if (old_table->pairs_hash != new_table->pairs_hash) {
+        diff_pairs(ctx, old_table, new_table);
+    }
+
+    if (diff_tables(ctx, old_table->subtables, new_table->subtables) != 0) return -1;
+
+    // Array-of-tables elements are matched by position
+    const TomlTable *old_element = old_table->array_of_tables;
+    const TomlTable *new_element = new_table->array_of_tables;
+    for (size_t index = 0; old_element || new_element; index++) {
+        size_t saved_len;
+        if (push_path(ctx, NULL, index, 1, &saved_len) != 0) return -1;
+
+        int result = 0;
+        if (!new_element) {
+            ctx->callback(ctx->path, NULL, TOML_DIFF_REMOVED, ctx->userdata);
+        } else if (!old_element) {
+            ctx->callback(ctx->path, NULL, TOML_DIFF_ADDED, ctx->userdata);
+        } else if (old_element->hash != new_element->hash) {
+            result = diff_table_contents(ctx, old_element, new_element);
+        }
+        ctx->path[saved_len] = '\0';
+        if (result != 0) return -1;
+
+        if (old_element) old_element = old_element->next;
+        if (new_element) new_element = new_element->next;
+    }
+    return 0;
+}
+
+static const TomlTable *find_sibling(const TomlTable *list, const char *name) {
+    for (; list; list = list->next) {
+        if (strcmp(list->name, name) == 0) return list;
+    }
+    return NULL;
+}
+
+static int diff_tables(DiffContext *ctx, const TomlTable *old_list, const TomlTable *new_list) {
+    for (const TomlTable *old_table = old_list; old_table; old_table = old_table->next) {
+        const TomlTable *new_table = find_sibling(new_list, old_table->name);
+        if (new_table && new_table->hash == old_table->hash) continue; // Identical subtree
+
+        size_t saved_len;
+        if (push_path(ctx, old_table->name, 0, 0, &saved_len) != 0) return -1;
+
+        int result = 0;
+        if (!new_table) {
+            ctx->callback(ctx->path, NULL, TOML_DIFF_REMOVED, ctx->userdata);
+        } else {
+            result = diff_table_contents(ctx, old_table, new_table);
+        }
+        ctx->path[saved_len] = '\0';
+        if (result != 0) return -1;
+    }
+
+    for (const TomlTable *new_table = new_list; new_table; new_table = new_table->next) {
+        if (find_sibling(old_list, new_table->name)) continue;
+
+        size_t saved_len;
+        if (push_path(ctx, new_table->name, 0, 0, &saved_len) != 0) return -1;
+        ctx->callback(ctx->path, NULL, TOML_DIFF_ADDED, ctx->userdata);
+        ctx->path[saved_len] = '\0';
+    }
+    return 0;
+}
+
+int tomlinc_diff(const TomlTable *old_root, const TomlTable *new_root, TomlDiffCallback callback, void *userdata) {
+    if (!callback) return -1;
+    // Image handles have no tree to compare
+    if ((old_root && old_root->doc && old_root->doc->image) || (new_root && new_root->doc && new_root->doc->image)) return -1;
+
+    DiffContext ctx;
+    ctx.callback = callback;
+    ctx.userdata = userdata;
+    ctx.path[0] = '\0';
+
+    return diff_tables(&ctx, old_root, new_root);
+}
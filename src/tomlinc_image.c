@@ -0,0 +1,564 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Flat document images. A whole document is laid out in one block of memory
+// that holds no pointers, only offsets, so it can be mapped at any address
+// (see tomlinc_shm.c) and read in place by the getters. Tables, pairs and
+// names are addressed from the start of the image. Array contents are
+// addressed from the array itself, because an array handle has to be usable
+// without knowing which image it came from.
+
+#define IMAGE_MAGIC 0x494c4d54u // "TMLI"
+#define IMAGE_VERSION 1
+
+#define IMAGE_TABLE_ARRAY_CONTAINER 1u
+#define IMAGE_TABLE_ARRAY_ELEMENT 2u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint64_t generation;
+    uint32_t tables;        // Top-level tables
+    uint32_t table_count;
+    uint32_t path_slots;    // Index of full table paths
+    uint32_t path_slot_count;
+} ImageHeader;
+
+typedef union {
+    uint32_t offset;        // Strings and arrays
+    int integer;            // Integers and booleans
+    float floating;
+} ImageValue;
+
+typedef struct {
+    uint32_t name;
+    uint32_t name_length;   // Compared before the name itself
+    uint32_t flags;
+    uint32_t pairs;
+    uint32_t pair_count;
+    uint32_t subtables;
+    uint32_t subtable_count;
+    uint32_t elements;      // Array-of-tables elements of a container
+    uint32_t element_count;
+} ImageTable;
+
+typedef struct {
+    uint32_t key;
+    uint32_t type;
+    ImageValue value;
+} ImagePair;
+
+typedef struct {
+    uint32_t hash;          // Low bits of hash_string(0, path)
+    uint32_t path;          // 0 marks an empty slot
+    uint32_t table;         // Where walking the path ends
+} ImagePathSlot;
+
+typedef struct {
+    uint32_t type;
+    uint32_t precision;
+    ImageValue value;       // Offsets are relative to the ImageArray
+} ImageElement;
+
+typedef struct {
+    uint32_t flat;          // Always 1, lines up with TomlArray.flat
+    uint32_t count;
+    ImageElement values[];
+} ImageArray;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+
+    // Table names and keys repeat a lot, especially in arrays of tables
+    uint32_t *names;        // Offsets of interned strings, 0 marks an empty slot
+    uint64_t *name_hashes;
+    size_t name_capacity;
+    size_t name_count;
+} ImageBuilder;
+
+// Zeroed, 8-byte aligned space at the end of the image. Offset 0 is the header,
+// so 0 doubles as the failure value.
+static uint32_t reserve(ImageBuilder *b, size_t len) {
+    if (b->failed) return 0;
+
+    size_t offset = (b->size + 7) & ~(size_t)7;
+    if (offset + len > UINT32_MAX) {
+        b->failed = 1; // Offsets are 32 bits
+        return 0;
+    }
+    if (offset + len > b->capacity) {
+        size_t new_capacity = b->capacity ? b->capacity : 4096;
+        while (new_capacity < offset + len) new_capacity *= 2;
+        unsigned char *new_data = realloc(b->data, new_capacity);
+        if (!new_data) {
+            b->failed = 1;
+            return 0;
+        }
+        b->data = new_data;
+        b->capacity = new_capacity;
+    }
+
+    memset(b->data + b->size, 0, offset + len - b->size);
+    b->size = offset + len;
+    return (uint32_t)offset;
+}
+
+static uint32_t write_string(ImageBuilder *b, const char *str) {
+    size_t len = strlen(str) + 1;
+    uint32_t offset = reserve(b, len);
+    if (offset) memcpy(b->data + offset, str, len);
+    return offset;
+}
+
+static uint32_t write_name(ImageBuilder *b, const char *name) {
+    if ((b->name_count + 1) * 2 > b->name_capacity) {
+        size_t new_capacity = b->name_capacity ? b->name_capacity * 2 : 256;
+        uint32_t *new_names = calloc(new_capacity, sizeof(uint32_t));
+        uint64_t *new_hashes = calloc(new_capacity, sizeof(uint64_t));
+        if (!new_names || !new_hashes) {
+            free(new_names);
+            free(new_hashes);
+            return write_string(b, name); // Still correct, only not shared
+        }
+        for (size_t i = 0; i < b->name_capacity; i++) {
+            if (!b->names[i]) continue;
+            size_t j = b->name_hashes[i] & (new_capacity - 1);
+            while (new_names[j]) j = (j + 1) & (new_capacity - 1);
+            new_names[j] = b->names[i];
+            new_hashes[j] = b->name_hashes[i];
+        }
+        free(b->names);
+        free(b->name_hashes);
+        b->names = new_names;
+        b->name_hashes = new_hashes;
+        b->name_capacity = new_capacity;
+    }
+
+    uint64_t hash = hash_string(0, name);
+    size_t i = hash & (b->name_capacity - 1);
+    for (; b->names[i]; i = (i + 1) & (b->name_capacity - 1)) {
+        if (b->name_hashes[i] == hash && strcmp((const char *)b->data + b->names[i], name) == 0) {
+            return b->names[i];
+        }
+    }
+
+    uint32_t offset = write_string(b, name);
+    if (offset) {
+        b->names[i] = offset;
+        b->name_hashes[i] = hash;
+        b->name_count++;
+    }
+    return offset;
+}
+
+static uint32_t write_array(ImageBuilder *b, const TomlArray *array);
+
+// Store a value, offsets are taken relative to base
+static ImageValue write_value(ImageBuilder *b, const void *value, TomlValueType type, uint32_t base) {
+    ImageValue out = { 0 };
+    switch (type) {
+        case TOML_VALUE_STRING:
+            out.offset = write_string(b, (const char *)value) - base;
+            break;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL:
+            out.integer = *(const int *)value;
+            break;
+        case TOML_VALUE_FLOAT:
+            out.floating = *(const float *)value;
+            break;
+        case TOML_VALUE_ARRAY:
+            out.offset = write_array(b, (const TomlArray *)value) - base;
+            break;
+    }
+    return out;
+}
+
+static uint32_t write_array(ImageBuilder *b, const TomlArray *array) {
+    uint32_t offset = reserve(b, sizeof(ImageArray) + sizeof(ImageElement) * array->count);
+    if (!offset) return 0;
+
+    ((ImageArray *)(b->data + offset))->flat = 1;
+    ((ImageArray *)(b->data + offset))->count = (uint32_t)array->count;
+    for (size_t i = 0; i < array->count; i++) {
+        // Writing the value may move the buffer, look the element up afterwards
+        ImageValue value = write_value(b, array->values[i], array->types[i], offset);
+        if (b->failed) return 0;
+
+        ImageElement *element = &((ImageArray *)(b->data + offset))->values[i];
+        element->type = array->types[i];
+        element->precision = array->types[i] == TOML_VALUE_FLOAT ? (uint32_t)array->float_precisions[i] : 0;
+        element->value = value;
+    }
+    return offset;
+}
+
+typedef struct {
+    const TomlPair *pair;
+    size_t position;        // In the pair list, keeps duplicate keys in order
+} SortedPair;
+
+static int compare_sorted_pairs(const void *a, const void *b) {
+    const SortedPair *pa = (const SortedPair *)a;
+    const SortedPair *pb = (const SortedPair *)b;
+    int cmp = strcmp(pa->pair->key, pb->pair->key);
+    if (cmp != 0) return cmp;
+    return pa->position < pb->position ? -1 : pa->position > pb->position;
+}
+
+// Write the pairs of a table sorted by key, at offset out
+static void write_pairs(ImageBuilder *b, const TomlTable *table, uint32_t out, uint32_t count) {
+    SortedPair stack_sorted[32];
+    SortedPair *sorted = stack_sorted;
+    if (count > sizeof(stack_sorted) / sizeof(stack_sorted[0])) {
+        sorted = malloc(sizeof(SortedPair) * count);
+        if (!sorted) {
+            b->failed = 1;
+            return;
+        }
+    }
+
+    size_t position = 0;
+    for (const TomlPair *pair = table->pairs; pair; pair = pair->next, position++) {
+        sorted[position].pair = pair;
+        sorted[position].position = position;
+    }
+    qsort(sorted, count, sizeof(SortedPair), compare_sorted_pairs);
+
+    for (uint32_t i = 0; i < count && !b->failed; i++) {
+        const TomlPair *pair = sorted[i].pair;
+        uint32_t key = write_name(b, pair->key);
+        ImageValue value = write_value(b, pair->value, pair->type, 0);
+        if (b->failed) break;
+
+        ImagePair *slot = (ImagePair *)(b->data + out) + i;
+        slot->key = key;
+        slot->type = pair->type;
+        slot->value = value;
+    }
+
+    if (sorted != stack_sorted) free(sorted);
+}
+
+// Write a list of sibling tables as one contiguous ImageTable array
+static uint32_t write_tables(ImageBuilder *b, const TomlTable *list, uint32_t *count) {
+    *count = 0;
+    for (const TomlTable *table = list; table; table = table->next) (*count)++;
+    if (*count == 0) return 0;
+
+    uint32_t offset = reserve(b, sizeof(ImageTable) * *count);
+    uint32_t index = 0;
+    for (const TomlTable *table = list; table && !b->failed; table = table->next, index++) {
+        ImageTable out = { 0 };
+        out.name = write_name(b, table->name);
+        out.name_length = (uint32_t)strlen(table->name);
+        out.flags = (table->is_array_container ? IMAGE_TABLE_ARRAY_CONTAINER : 0) |
+                    (table->is_array_of_tables_element ? IMAGE_TABLE_ARRAY_ELEMENT : 0);
+
+        for (const TomlPair *pair = table->pairs; pair; pair = pair->next) out.pair_count++;
+        out.pairs = out.pair_count ? reserve(b, sizeof(ImagePair) * out.pair_count) : 0;
+        if (out.pair_count) write_pairs(b, table, out.pairs, out.pair_count);
+
+        out.subtables = write_tables(b, table->subtables, &out.subtable_count);
+        out.elements = write_tables(b, table->array_of_tables, &out.element_count);
+        if (b->failed) break;
+
+        memcpy((ImageTable *)(b->data + offset) + index, &out, sizeof(out));
+    }
+    return offset;
+}
+
+typedef struct {
+    const ImageTable *list;
+    uint32_t count;
+    uint32_t index;
+} ImageCursor;
+
+// Same search order as find_table_recursive_n: the table itself, its
+// subtables, then the siblings that follow it
+static int find_table_n(const unsigned char *base, ImageCursor *cursor, const char *name, size_t len) {
+    for (uint32_t i = cursor->index; i < cursor->count; i++) {
+        const ImageTable *table = &cursor->list[i];
+        if (table->name_length == len && memcmp(base + table->name, name, len) == 0) {
+            cursor->index = i;
+            return 1;
+        }
+
+        if (table->subtable_count) {
+            ImageCursor child = { (const ImageTable *)(base + table->subtables), table->subtable_count, 0 };
+            if (find_table_n(base, &child, name, len)) {
+                *cursor = child;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Walk table_path segment by segment, the way resolve_table_path does
+static const ImageTable *resolve_path(const unsigned char *base, uint32_t tables, uint32_t table_count, const char *table_path) {
+    if (table_count == 0) return NULL;
+
+    ImageCursor cursor = { (const ImageTable *)(base + tables), table_count, 0 };
+    const char *token = table_path;
+    while (*token) {
+        if (*token == '.') {
+            token++; // Empty segments are skipped, as in resolve_table_path
+            continue;
+        }
+        size_t len = strcspn(token, ".");
+        if (!find_table_n(base, &cursor, token, len)) return NULL;
+        token += len;
+    }
+    return &cursor.list[cursor.index];
+}
+
+typedef struct {
+    uint64_t hash;
+    uint32_t path;
+    uint32_t table;
+} PathEntry;
+
+typedef struct {
+    PathEntry *entries;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+// Add the full path of every table below tables to list, together with the
+// table a walk of that path ends at. Paths longer than the buffer are left
+// out, lookups of them fall back to the walk.
+static void collect_paths(ImageBuilder *b, PathList *list, uint32_t root_tables, uint32_t root_count,
+                          uint32_t tables, uint32_t count, char *path, size_t length, size_t path_size) {
+    for (uint32_t i = 0; i < count && !b->failed; i++) {
+        // Writing strings may move the buffer, so tables are looked up by offset every time
+        uint32_t offset = tables + i * (uint32_t)sizeof(ImageTable);
+        const ImageTable *table = (const ImageTable *)(b->data + offset);
+        uint32_t subtables = table->subtables;
+        uint32_t subtable_count = table->subtable_count;
+        size_t name_length = table->name_length;
+        size_t new_length = length + (length ? 1 : 0) + name_length;
+        if (new_length >= path_size) continue;
+
+        if (length) path[length] = '.';
+        memcpy(path + new_length - name_length, b->data + table->name, name_length);
+        path[new_length] = '\0';
+
+        if (list->count == list->capacity) {
+            size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+            PathEntry *new_entries = realloc(list->entries, sizeof(PathEntry) * new_capacity);
+            if (!new_entries) {
+                b->failed = 1;
+                return;
+            }
+            list->entries = new_entries;
+            list->capacity = new_capacity;
+        }
+
+        // An earlier table of the same name can lead the walk elsewhere, even nowhere
+        const ImageTable *target = resolve_path(b->data, root_tables, root_count, path);
+        if (target) {
+            uint32_t table_offset = (uint32_t)((const unsigned char *)target - b->data);
+            uint32_t path_offset = write_string(b, path);
+            if (b->failed) return;
+
+            PathEntry *entry = &list->entries[list->count++];
+            entry->hash = hash_string(0, path);
+            entry->path = path_offset;
+            entry->table = table_offset;
+        }
+
+        collect_paths(b, list, root_tables, root_count, subtables, subtable_count, path, new_length, path_size);
+    }
+}
+
+// Hash index from full table paths to tables, so lookups skip the walk
+static uint32_t write_path_index(ImageBuilder *b, uint32_t tables, uint32_t table_count, uint32_t *slot_count) {
+    char path[1024];
+    PathList list = { 0 };
+    collect_paths(b, &list, tables, table_count, tables, table_count, path, 0, sizeof(path));
+
+    uint32_t offset = 0;
+    *slot_count = 0;
+    if (list.count > 0 && !b->failed) {
+        uint32_t slots = 8;
+        while (slots < list.count * 2) slots *= 2;
+        offset = reserve(b, sizeof(ImagePathSlot) * slots);
+        if (offset) {
+            ImagePathSlot *index = (ImagePathSlot *)(b->data + offset);
+            for (size_t i = 0; i < list.count; i++) {
+                uint32_t slot = (uint32_t)list.entries[i].hash & (slots - 1);
+                while (index[slot].path) slot = (slot + 1) & (slots - 1);
+                index[slot].hash = (uint32_t)list.entries[i].hash;
+                index[slot].path = list.entries[i].path;
+                index[slot].table = list.entries[i].table;
+            }
+            *slot_count = slots;
+        }
+    }
+    free(list.entries);
+    return offset;
+}
+
+// Lay the document out as an image in one heap block, returned with its size
+unsigned char *image_build(const TomlTable *root, uint64_t generation, size_t *size) {
+    ImageBuilder b = { 0 };
+    reserve(&b, sizeof(ImageHeader));
+
+    uint32_t table_count;
+    uint32_t tables = write_tables(&b, root, &table_count);
+    uint32_t path_slot_count;
+    uint32_t path_slots = write_path_index(&b, tables, table_count, &path_slot_count);
+
+    free(b.names);
+    free(b.name_hashes);
+    if (b.failed || !b.data) {
+        free(b.data);
+        return NULL;
+    }
+
+    ImageHeader *header = (ImageHeader *)b.data;
+    header->magic = IMAGE_MAGIC;
+    header->version = IMAGE_VERSION;
+    header->size = b.size;
+    header->generation = generation;
+    header->tables = tables;
+    header->table_count = table_count;
+    header->path_slots = path_slots;
+    header->path_slot_count = path_slot_count;
+
+    *size = b.size;
+    return b.data;
+}
+
+// The header is checked; the contents are trusted, images come from image_build
+int image_check(const unsigned char *base, size_t size) {
+    if (!base || size < sizeof(ImageHeader)) return -1;
+
+    const ImageHeader *header = (const ImageHeader *)base;
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION) return -1;
+    if (header->size > size) return -1;
+    return 0;
+}
+
+uint64_t image_generation(const unsigned char *base) {
+    return ((const ImageHeader *)base)->generation;
+}
+
+const void *image_find_value(const TomlImage *image, const char *table_path, const char *key, TomlValueType *type) {
+    const unsigned char *base = image->base;
+    const ImageHeader *header = (const ImageHeader *)base;
+    const ImageTable *table = NULL;
+
+    if (header->path_slot_count) {
+        uint64_t hash = hash_string(0, table_path);
+        const ImagePathSlot *index = (const ImagePathSlot *)(base + header->path_slots);
+        for (uint32_t slot = (uint32_t)hash & (header->path_slot_count - 1); index[slot].path;
+             slot = (slot + 1) & (header->path_slot_count - 1)) {
+            if (index[slot].hash == (uint32_t)hash && strcmp((const char *)base + index[slot].path, table_path) == 0) {
+                table = (const ImageTable *)(base + index[slot].table);
+                break;
+            }
+        }
+    }
+    if (!table) table = resolve_path(base, header->tables, header->table_count, table_path); // Not spelled out in full
+    if (!table || table->pair_count == 0) return NULL;
+
+    // First pair whose key is not below key. The loop runs log2(n) times and
+    // only the comparison branches, the step is a conditional move.
+    const ImagePair *pair = (const ImagePair *)(base + table->pairs);
+    uint32_t count = table->pair_count;
+    while (count > 1) {
+        uint32_t half = count / 2;
+        pair += strcmp((const char *)base + pair[half - 1].key, key) < 0 ? half : 0;
+        count -= half;
+    }
+    if (strcmp((const char *)base + pair->key, key) != 0) return NULL;
+
+    *type = (TomlValueType)pair->type;
+    if (*type == TOML_VALUE_STRING || *type == TOML_VALUE_ARRAY) {
+        return base + pair->value.offset;
+    }
+    return &pair->value; // int, bool and float sit in the pair itself
+}
+
+size_t image_array_count(const void *array_handle) {
+    return ((const ImageArray *)array_handle)->count;
+}
+
+int image_array_element(const void *array_handle, size_t index, TomlValueType *type, const void **value, size_t *precision) {
+    const ImageArray *array = (const ImageArray *)array_handle;
+    if (index >= array->count) return -1;
+
+    const ImageElement *element = &array->values[index];
+    *type = (TomlValueType)element->type;
+    if (value) {
+        if (*type == TOML_VALUE_STRING || *type == TOML_VALUE_ARRAY) {
+            *value = (const unsigned char *)array + element->value.offset;
+        } else {
+            *value = &element->value;
+        }
+    }
+    if (precision) *precision = element->precision;
+    return 0;
+}
+
+// Wrap an image in a handle for the getters. The handle owns the image and
+// releases it in tomlinc_close_file.
+TomlTable *image_handle_create(TomlImage *image) {
+    TomlTable *handle = calloc(1, sizeof(TomlTable));
+    if (!handle) return NULL;
+
+    // The handle is an empty table that only the getters look through. Saving,
+    // printing, iterating, encoding, diffing and queries reject it instead of
+    // reporting an empty document.
+    handle->name = strdup("");
+    handle->doc = calloc(1, sizeof(TomlDocument));
+    if (!handle->name || !handle->doc) {
+        free(handle->name);
+        free(handle->doc);
+        free(handle);
+        return NULL;
+    }
+
+    handle->doc->image = image;
+    handle->doc->generation = image_generation(image->base);
+    return handle;
+}
+
+static void frozen_release(TomlImage *image) {
+    free((void *)image->base);
+    free(image);
+}
+
+// Read-only copy of a document in a single heap block, see image_build. The
+// document itself is left as it is and can be closed independently.
+TomlTable *tomlinc_freeze(const TomlTable *root_table) {
+    if (!root_table) return NULL;
+    if (root_table->doc && (root_table->doc->overlay || root_table->doc->image)) return NULL;
+
+    TomlImage *image = calloc(1, sizeof(TomlImage));
+    if (!image) return NULL;
+
+    uint64_t generation = root_table->doc ? atomic_load(&root_table->doc->generation) : 0;
+    size_t size;
+    unsigned char *base = image_build(root_table, generation, &size);
+    if (!base) {
+        free(image);
+        return NULL;
+    }
+    image->base = base;
+    image->size = size;
+    image->release = frozen_release;
+
+    TomlTable *handle = image_handle_create(image);
+    if (!handle) frozen_release(image);
+    return handle;
+}
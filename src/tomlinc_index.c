@@ -0,0 +1,249 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hash indexes over an array of tables, keyed by the value of one field in
+// each element. An index on a document is attached to its container, and the
+// setters, which reach the container through the parent links of the changed
+// table, move the slot of an element whose indexed field changed. Every other
+// change inside the array of tables only moves the container's fingerprint,
+// which the index follows by the same delta. Lookups rebuild the slots when
+// the fingerprint differs anyway, or when nodes were copied after a fork.
+
+typedef struct {
+    uint64_t hash;
+    const TomlTable *element; // NULL marks an empty slot
+    const TomlPair *pair;     // The indexed field of the element
+} IndexSlot;
+
+struct TomlAotIndex {
+    const TomlTable *root;
+    char *table_path;
+    char *key;
+    TomlAotIndex *next;       // Next index attached to the same container
+
+    const TomlTable *container;
+    uint64_t layout;          // Document layout the container was resolved at
+    uint64_t container_hash;  // Container fingerprint the slots describe
+    int attached;             // Listed in the container, see attach_index
+    int stale;                // A change could not be applied in place
+
+    IndexSlot *slots;
+    size_t capacity;          // Power of two
+    size_t used;
+    size_t duplicates;        // Elements left out because an earlier one has their value
+};
+
+static uint64_t document_layout(const TomlTable *root) {
+    return root->doc ? root->doc->layout : 0;
+}
+
+static int indexable(TomlValueType type) {
+    return type != TOML_VALUE_ARRAY; // Only scalar fields are indexed
+}
+
+// Put element into the slots, unless an element with an equal value is there
+static int insert_slot(TomlAotIndex *index, uint64_t hash, const TomlTable *element, const TomlPair *pair) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+    while (index->slots[i].element) {
+        const IndexSlot *slot = &index->slots[i];
+        if (slot->hash == hash && values_equal(slot->pair->value, slot->pair->type, pair->value, pair->type)) {
+            return -1;
+        }
+        i = (i + 1) & mask;
+    }
+
+    index->slots[i].hash = hash;
+    index->slots[i].element = element;
+    index->slots[i].pair = pair;
+    index->used++;
+    return 0;
+}
+
+// Take element out of the probe sequence of hash. Later entries of the run are
+// shifted back so no lookup stops at the hole. Returns 0 if element was there.
+static int remove_slot(TomlAotIndex *index, uint64_t hash, const TomlTable *element) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+    while (index->slots[i].element != element) {
+        if (!index->slots[i].element) return -1;
+        i = (i + 1) & mask;
+    }
+
+    for (size_t j = (i + 1) & mask; index->slots[j].element; j = (j + 1) & mask) {
+        size_t home = index->slots[j].hash & mask;
+        // The entry can move into the hole unless its home lies between the two
+        int stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            index->slots[i] = index->slots[j];
+            i = j;
+        }
+    }
+    index->slots[i].element = NULL;
+    index->used--;
+    return 0;
+}
+
+static int build_index(TomlAotIndex *index) {
+    size_t count = 0;
+    for (const TomlTable *element = index->container->array_of_tables; element; element = element->next) {
+        count++;
+    }
+
+    size_t capacity = 16;
+    while (capacity < count * 2) capacity *= 2;
+
+    IndexSlot *slots = calloc(capacity, sizeof(IndexSlot));
+    if (!slots) return -1;
+
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    index->used = 0;
+    index->duplicates = 0;
+
+    for (const TomlTable *element = index->container->array_of_tables; element; element = element->next) {
+        const TomlPair *pair = find_pair(element, index->key);
+        if (!pair || !indexable(pair->type)) continue;
+
+        // On a duplicate value the first element keeps it
+        if (insert_slot(index, value_hash(pair->value, pair->type), element, pair) != 0) index->duplicates++;
+    }
+
+    index->container_hash = index->container->hash;
+    index->stale = 0;
+    return 0;
+}
+
+static void attach_index(TomlAotIndex *index) {
+    TomlTable *container = (TomlTable *)index->container;
+    index->next = container->indexes;
+    container->indexes = index;
+    index->attached = 1;
+}
+
+static void detach_index(TomlAotIndex *index) {
+    if (!index->attached) return;
+
+    TomlAotIndex **link = &((TomlTable *)index->container)->indexes;
+    while (*link && *link != index) link = &(*link)->next;
+    if (*link) *link = index->next;
+    index->attached = 0;
+}
+
+// The container is being freed, its indexes look it up again when used
+void indexes_detach(TomlTable *container) {
+    for (TomlAotIndex *index = container->indexes; index; index = index->next) {
+        index->attached = 0;
+        index->container = NULL;
+    }
+    container->indexes = NULL;
+}
+
+// Make sure the slots describe the current elements, rebuilding them if needed
+static int refresh_index(TomlAotIndex *index) {
+    uint64_t layout = document_layout(index->root);
+    if (!index->container || layout != index->layout) {
+        // Nodes were copied (see tomlinc_fork), the container and elements may have moved
+        const TomlTable *container = resolve_table_path(index->root, index->table_path);
+        if (!container || !container->is_array_container) return -1;
+        if (container != index->container) {
+            detach_index(index);
+            index->container = container;
+            if (index->root->doc) attach_index(index);
+        }
+        index->layout = layout;
+        index->stale = 1;
+    }
+
+    if (!index->slots || index->stale || index->container->hash != index->container_hash) {
+        return build_index(index);
+    }
+    return 0;
+}
+
+// Move the slot of an element whose indexed field went from old_value to the
+// pair's current value
+static void move_element(TomlAotIndex *index, const TomlTable *element, const TomlPair *pair, const void *old_value) {
+    if (!indexable(pair->type)) return;
+
+    if (remove_slot(index, value_hash(old_value, pair->type), element) == 0) {
+        // Another element may have the old value too and should take it over
+        if (index->duplicates > 0) index->stale = 1;
+    } else if (index->duplicates > 0) {
+        index->duplicates--; // It was one of those
+    }
+
+    // Which of two elements with the new value comes first would take a scan
+    if (insert_slot(index, value_hash(pair->value, pair->type), element, pair) != 0) {
+        index->stale = 1;
+    }
+}
+
+void indexes_changed(const TomlTable *table, const TomlPair *pair, const void *old_value, uint64_t delta) {
+    for (const TomlTable *container = table; container; container = container->parent) {
+        for (TomlAotIndex *index = container->indexes; index; index = index->next) {
+            if (index->stale || index->layout != document_layout(index->root)) continue; // Rebuilt anyway
+
+            if (old_value && table->parent == container && table->is_array_of_tables_element &&
+                strcmp(pair->key, index->key) == 0) {
+                move_element(index, table, pair, old_value);
+            }
+            index->container_hash += delta;
+        }
+    }
+}
+
+TomlAotIndex *tomlinc_aot_create_index(const TomlTable *root_table, const char *table_path, const char *key) {
+    if (!root_table || !table_path || !key) return NULL;
+
+    const TomlTable *container = resolve_table_path(root_table, table_path);
+    if (!container || !container->is_array_container) return NULL;
+
+    TomlAotIndex *index = calloc(1, sizeof(TomlAotIndex));
+    if (!index) return NULL;
+
+    index->root = root_table;
+    index->container = container;
+    index->layout = document_layout(root_table);
+    index->table_path = strdup(table_path);
+    index->key = strdup(key);
+    if (!index->table_path || !index->key || build_index(index) != 0) {
+        tomlinc_aot_free_index(index);
+        return NULL;
+    }
+
+    // Embedded trees are read-only, and element handles are not documents
+    if (root_table->doc) attach_index(index);
+    return index;
+}
+
+// value is passed like to the array setters: a char * for strings, a pointer
+// to an int or float otherwise
+const TomlTable *tomlinc_aot_find(TomlAotIndex *index, const void *value, TomlValueType type) {
+    if (!index || !value || type == TOML_VALUE_ARRAY) return NULL;
+    if (refresh_index(index) != 0) return NULL;
+
+    uint64_t hash = value_hash(value, type);
+    size_t mask = index->capacity - 1;
+    for (size_t i = hash & mask; index->slots[i].element; i = (i + 1) & mask) {
+        const IndexSlot *slot = &index->slots[i];
+        if (slot->hash == hash && values_equal(slot->pair->value, slot->pair->type, value, type)) {
+            return slot->element;
+        }
+    }
+    return NULL;
+}
+
+void tomlinc_aot_free_index(TomlAotIndex *index) {
+    if (!index) return;
+
+    detach_index(index);
+    free(index->slots);
+    free(index->table_path);
+    free(index->key);
+    free(index);
+}
@@ -16,356 +16,15 @@ char *trim_whitespace(char *str) {
     return str;
 }
 
-TomlPair *parse_pair(const char *line, FILE *file) {
-    char *eq_pos = strchr(line, '=');
-    if (!eq_pos) return NULL; // Not a valid pair
-
-    *eq_pos = '\0'; 
-    char *key = trim_whitespace((char *)line);
-    char *value_str = trim_whitespace(eq_pos + 1);
-
-    TomlPair *pair = malloc(sizeof(TomlPair));
-    if (!pair) return NULL;
-
-    pair->key = strdup(key);
-    pair->next = NULL;
-
-    if (*value_str == '[') {
-        // Parse array
-        pair->value = parse_array(value_str, file);
-        pair->type = TOML_VALUE_ARRAY;
-        if (!pair->value) {
-            free(pair->key);
-            free(pair);
-            return NULL;
-        }
-    } else if ((*value_str == '"' && value_str[strlen(value_str) - 1] == '"') ||
-               (*value_str == '\'' && value_str[strlen(value_str) - 1] == '\'')) {
-        // String
-        value_str[strlen(value_str) - 1] = '\0';
-        value_str++;
-        pair->value = strdup(value_str);
-        pair->type = TOML_VALUE_STRING;
-    } else if (strchr(value_str, '.')) {
-        // Float
-        float *fvalue = malloc(sizeof(float));
-        *fvalue = atof(value_str);
-        pair->value = fvalue;
-        pair->type = TOML_VALUE_FLOAT;
-    } else if (isdigit((unsigned char)*value_str) || (*value_str == '-' && isdigit((unsigned char)value_str[1]))) {
-        // Integer
-        int *ivalue = malloc(sizeof(int));
-        *ivalue = atoi(value_str);
-        pair->value = ivalue;
-        pair->type = TOML_VALUE_INT;
-    } else if (strcmp(value_str, "true") == 0 || strcmp(value_str, "false") == 0) {
-        // Bool
-        int *bvalue = malloc(sizeof(int));
-        *bvalue = (strcmp(value_str, "true") == 0);
-        pair->value = bvalue;
-        pair->type = TOML_VALUE_BOOL;
-    } else {
-        // Unsupported
-        free(pair->key);
-        free(pair);
-        return NULL;
-    }
-
-    return pair;
-}
-
-static TomlArray *parse_array(const char *line, FILE *file) {
-    TomlArray *array = malloc(sizeof(TomlArray));
-    if (!array) {
-        return NULL;
-    }
-
-    array->values = NULL;
-    array->types = NULL;
-    array->float_precisions = NULL;
-    array->count = 0;
-
-    size_t buffer_size = strlen(line) + 1;
-    char *buffer = malloc(buffer_size);
-    if (!buffer) {
-        free(array);
-        return NULL;
-    }
-    strcpy(buffer, line);
-
-    // Balance brackets
-    size_t open_brackets = 0, close_brackets = 0;
-    for (size_t i = 0; i < buffer_size; i++) {
-        if (buffer[i] == '[') open_brackets++;
-        if (buffer[i] == ']') close_brackets++;
-    }
-
-    while (open_brackets > close_brackets) {
-        char temp[256];
-        if (!fgets(temp, sizeof(temp), file)) {
-            free(buffer);
-            free(array);
-            return NULL;
-        }
-
-        temp[strcspn(temp, "\n")] = '\0'; // Remove newline
-        char *new_buffer = realloc(buffer, buffer_size + strlen(temp) + 1);
-        if (!new_buffer) {
-            free(buffer);
-            free(array);
-            return NULL;
-        }
-        buffer = new_buffer;
-        strcat(buffer, temp);
-        buffer_size += strlen(temp);
-
-        for (size_t i = 0; i < strlen(temp); i++) {
-            if (temp[i] == '[') open_brackets++;
-            if (temp[i] == ']') close_brackets++;
-        }
-    }
-
-    // Strip outer brackets
-    if (strlen(buffer) < 2) {
-        free(buffer);
-        free(array);
-        return NULL;
-    }
-
-    buffer[strlen(buffer) - 1] = '\0'; // remove trailing ']'
-    char *content = buffer + 1; // skip leading '['
-
-    while (content && *content) {
-        content = trim_whitespace(content);
-        if (!content || !*content) {
-            break;
-        }
-
-        if (*content == '[') {
-            // Nested array
-            const char *start = content;
-            size_t nested_balance = 1, nested_length = 1;
-            while (nested_balance > 0) {
-                char c = content[nested_length++];
-                if (c == '[') nested_balance++;
-                if (c == ']') nested_balance--;
-                if (c == '\0') {
-                    free(buffer);
-                    free_array(array);
-                    return NULL;
-                }
-            }
-
-            char *nested_content = strndup(start, nested_length);
-            if (!nested_content) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            TomlArray *nested_array = parse_array(nested_content, file);
-            free(nested_content);
-
-            if (!nested_array) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-            TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-            if (!new_values || !new_types) {
-                if (new_values) array->values = new_values;
-                free_array(nested_array);
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            array->values = new_values;
-            array->types = new_types;
-
-            array->values[array->count] = nested_array;
-            array->types[array->count] = TOML_VALUE_ARRAY;
-            array->count++;
-
-            content += nested_length;
-        } else if ((*content == '"' && strchr(content + 1, '"'))) {
-            // String
-            char quote_char = *content;
-            char *end_quote = strchr(content + 1, quote_char);
-            if (!end_quote) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            size_t length = end_quote - content - 1;
-            char *value = strndup(content + 1, length);
-            if (!value) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-            TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-            if (!new_values || !new_types) {
-                free(value);
-                if (new_values) array->values = new_values;
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            array->values = new_values;
-            array->types = new_types;
-
-            array->values[array->count] = value;
-            array->types[array->count] = TOML_VALUE_STRING;
-            array->count++;
-
-            content = end_quote + 1;
-        } else if ((*content == 't' && strncmp(content, "true", 4) == 0) || 
-                   (*content == 'f' && strncmp(content, "false", 5) == 0)) {
-            int *value = malloc(sizeof(int));
-            if (!value) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-            *value = (content[0] == 't') ? 1 : 0;
-
-            void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-            TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-            if (!new_values || !new_types) {
-                free(value);
-                if (new_values) array->values = new_values;
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            array->values = new_values;
-            array->types = new_types;
-
-            array->values[array->count] = value;
-            array->types[array->count] = TOML_VALUE_BOOL;
-            array->count++;
-
-            content += (content[0] == 't') ? 4 : 5; // Move past "true" or "false"
-        } else if (isdigit((unsigned char)*content) || (*content == '-' && isdigit((unsigned char)content[1]))) {
-            // Find the end of this token (comma or end of line)
-            char *comma = strchr(content, ',');
-            size_t token_length = comma ? (size_t)(comma - content) : strlen(content);
-
-            // Extract the first token
-            char *token_str = strndup(content, token_length);
-            if (!token_str) {
-                free(buffer);
-                free_array(array);
-                return NULL;
-            }
-
-            // Determine if it's float or int by checking only token_str
-            if (strchr(token_str, '.')) {
-                // Parse as float
-                float *value = malloc(sizeof(float));
-                if (!value) {
-                    free(token_str);
-                    free(buffer);
-                    free_array(array);
-                    return NULL;
-                }
-                *value = strtof(token_str, NULL);
-
-                // Calculate the precision
-                size_t precision = 0;
-                char *dot = strchr(token_str, '.');
-                if (dot) {
-                    precision = strlen(dot + 1); // Count characters after the dot
-                }
-
-                // Reallocate precision array
-                size_t *new_precisions = realloc(array->float_precisions, sizeof(size_t) * (array->count + 1));
-                void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-                TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-                if (!new_values || !new_types || !new_precisions) {
-                    free(value);
-                    if (new_values) array->values = new_values;
-                    if (new_precisions) array->float_precisions = new_precisions;
-                    free(token_str);
-                    free(buffer);
-                    free_array(array);
-                    return NULL;
-                }
-
-                array->values = new_values;
-                array->types = new_types;
-                array->float_precisions = new_precisions;
-
-                array->values[array->count] = value;
-                array->types[array->count] = TOML_VALUE_FLOAT;
-                array->float_precisions[array->count] = precision; // Store precision
-                array->count++;
-            } else {
-                // Parse as integer
-                int *value = malloc(sizeof(int));
-                if (!value) {
-                    free(token_str);
-                    free(buffer);
-                    free_array(array);
-                    return NULL;
-                }
-                *value = atoi(token_str);
-
-                void **new_values = realloc(array->values, sizeof(void *) * (array->count + 1));
-                TomlValueType *new_types = realloc(array->types, sizeof(TomlValueType) * (array->count + 1));
-                if (!new_values || !new_types) {
-                    free(value);
-                    if (new_values) array->values = new_values;
-                    free(token_str);
-                    free(buffer);
-                    free_array(array);
-                    return NULL;
-                }
-
-                array->values = new_values;
-                array->types = new_types;
-
-                array->values[array->count] = value;
-                array->types[array->count] = TOML_VALUE_INT;
-                array->count++;
-            }
-
-            free(token_str);
-
-            // Move content past the comma if present
-            if (comma) {
-                content = trim_whitespace(comma + 1);
-            } else {
-                content = NULL;
-            }
-        } else if (*content == ',') {
-            // Skip commas
-            content++;
-        } else {
-            break;
-        }
-    }
-
-    free(buffer);
-    return array;
-}
-
 TomlTable *find_or_create_table(TomlTable **root, const char *name) {
     if (!name || !*name) return NULL;
 
-    char *name_copy = strdup(name);
+    char *name_copy = mem_strdup(name);
     if (!name_copy) return NULL;
     char *token = strtok(name_copy, ".");
     TomlTable **current = root;
     TomlTable *last_table = NULL;
+    TomlTable *parent = NULL;
 
     while (token) {
         TomlTable *table = *current;
@@ -379,12 +38,19 @@ TomlTable *find_or_create_table(TomlTable **root, const char *name) {
 
         if (!table) {
             // Create a normal table
-            table = calloc(1, sizeof(TomlTable));
+            table = mem_calloc(1, sizeof(TomlTable));
             if (!table) {
-                free(name_copy);
+                mem_free(name_copy);
+                return NULL;
+            }
+            table->name = mem_strdup(token);
+            if (!table->name) {
+                mem_free(table);
+                mem_free(name_copy);
                 return NULL;
             }
-            table->name = strdup(token);
+            table->parent = parent;
+            table->path_hash = table_path_hash(parent, token);
 
             // Append
             if (!*current) {
@@ -402,25 +68,27 @@ TomlTable *find_or_create_table(TomlTable **root, const char *name) {
         // If this table is an array container and we have more tokens,
         // navigate into the last array element's subtables, NOT table->subtables
         if (table->is_array_container && table->array_of_tables_last && token) {
-            current = &table->array_of_tables_last->subtables;
+            parent = table->array_of_tables_last;
         } else {
-            current = &table->subtables;
+            parent = table;
         }
+        current = &parent->subtables;
     }
 
-    free(name_copy);
+    mem_free(name_copy);
     return last_table;
 }
 
 TomlTable *find_or_create_array_of_tables(TomlTable **root, const char *name) {
     if (!name || !*name) return NULL;
 
-    char *name_copy = strdup(name);
+    char *name_copy = mem_strdup(name);
     if (!name_copy) return NULL;
 
     char *token = strtok(name_copy, ".");
     TomlTable **current = root;
     TomlTable *last_table = NULL;
+    TomlTable *parent = NULL;
 
     // Create/find intermediate tables for all tokens except the last
     while (1) {
@@ -435,12 +103,19 @@ TomlTable *find_or_create_array_of_tables(TomlTable **root, const char *name) {
 
         if (!table) {
             // Create an intermediate normal table
-            table = calloc(1, sizeof(TomlTable));
+            table = mem_calloc(1, sizeof(TomlTable));
             if (!table) {
-                free(name_copy);
+                mem_free(name_copy);
+                return NULL;
+            }
+            table->name = mem_strdup(token);
+            if (!table->name) {
+                mem_free(table);
+                mem_free(name_copy);
                 return NULL;
             }
-            table->name = strdup(token);
+            table->parent = parent;
+            table->path_hash = table_path_hash(parent, token);
             // other fields are NULL and zero-initialized by calloc
             // is_array_of_tables_element = 0, is_array_container = 0 by default
 
@@ -457,85 +132,503 @@ TomlTable *find_or_create_array_of_tables(TomlTable **root, const char *name) {
         last_table = table;
 
         if (!next_token) {
-            // Final token: turn last_table into a container
-            last_table->is_array_container = 1;
-
-            // Create the array-of-tables element using the final token
-            TomlTable *new_element = calloc(1, sizeof(TomlTable));
-            if (!new_element) {
-                free(name_copy);
-                return NULL;
-            }
-            new_element->name = strdup(token);
-            new_element->is_array_of_tables_element = 1;
-
-            // Add to array_of_tables
-            if (!last_table->array_of_tables) {
-                last_table->array_of_tables = new_element;
-                last_table->array_of_tables_last = new_element;
-            } else {
-                last_table->array_of_tables_last->next = new_element;
-                last_table->array_of_tables_last = new_element;
-            }
-
-            free(name_copy);
+            // Final token: turn last_table into a container with a new element
+            TomlTable *new_element = append_array_of_tables_element(last_table);
+            mem_free(name_copy);
             return new_element;
         }
 
         // Not final token, go deeper
+        parent = table;
         current = &table->subtables;
         token = next_token;
     }
 }
 
-void free_table(TomlTable *table) {
-    if (!table) return;
+// TomlSink writing into a fixed buffer. It keeps counting past the end so the
+// caller learns the size that would have been needed.
+int buffer_sink(const char *data, size_t len, void *userdata) {
+    BufferSink *out = (BufferSink *)userdata;
+    if (out->length < out->size) {
+        size_t room = out->size - out->length;
+        memcpy(out->buffer + out->length, data, len < room ? len : room);
+    }
+    out->length += len;
+    return 0;
+}
 
-    TomlPair *pair = table->pairs;
-    while (pair) {
-        TomlPair *next = pair->next;
-        if (pair->type == TOML_VALUE_ARRAY) {
-            free_array((TomlArray *)pair->value);
-        } else {
-            free(pair->value);
+// Turn the table into an array container if needed and append a new, empty element
+TomlTable *append_array_of_tables_element(TomlTable *container) {
+    container->is_array_container = 1;
+
+    // The element shares the name of its container
+    TomlTable *new_element = mem_calloc(1, sizeof(TomlTable));
+    if (!new_element) return NULL;
+    new_element->name = mem_strdup(container->name);
+    if (!new_element->name) {
+        mem_free(new_element);
+        return NULL;
+    }
+    new_element->is_array_of_tables_element = 1;
+    new_element->parent = container;
+    // Element paths chain off the previous element, so they encode the index
+    new_element->path_hash = table_path_hash(
+        container->array_of_tables_last ? container->array_of_tables_last : container, "[]");
+
+    // Index the element before linking it, so both views always agree
+    if (container->element_count == container->element_capacity) {
+        size_t new_capacity = container->element_capacity ? container->element_capacity * 2 : 8;
+        TomlTable **new_elements = mem_realloc(container->elements, sizeof(TomlTable *) * new_capacity);
+        if (!new_elements) {
+            mem_free(new_element->name);
+            mem_free(new_element);
+            return NULL;
         }
-        free(pair->key);
-        free(pair);
-        pair = next;
+        container->elements = new_elements;
+        container->element_capacity = new_capacity;
     }
+    container->elements[container->element_count++] = new_element;
 
-    TomlTable *subtable = table->subtables;
-    while (subtable) {
-        TomlTable *next = subtable->next;
-        free_table(subtable);
-        subtable = next;
+    // Add to array_of_tables
+    if (!container->array_of_tables) {
+        container->array_of_tables = new_element;
+        container->array_of_tables_last = new_element;
+    } else {
+        container->array_of_tables_last->next = new_element;
+        container->array_of_tables_last = new_element;
     }
+    return new_element;
+}
+
+void free_table(TomlTable *table) {
+    if (!table) return;
+
+    free_pairs(table->pairs);
+    free_tables(table->subtables);
 
     // Free array-of-tables
-    TomlTable *aot = table->array_of_tables;
-    while (aot) {
-        TomlTable *next = aot->next;
-        free_table(aot);
-        aot = next;
+    free_tables(table->array_of_tables);
+    mem_free(table->elements);
+    if (table->indexes) indexes_detach(table);
+
+    mem_free(table->name);
+    mem_free(table);
+}
+
+// Free a list of tables. Nodes can be shared between forked documents: a
+// shared node only loses one owner, and it keeps the rest of the list alive.
+void free_tables(TomlTable *table) {
+    while (table) {
+        if (table->shares > 0) {
+            table->shares--;
+            return;
+        }
+        TomlTable *next = table->next;
+        free_table(table);
+        table = next;
     }
+}
 
-    free(table->name);
-    free(table);
+void free_pairs(TomlPair *pair) {
+    while (pair) {
+        if (pair->shares > 0) {
+            pair->shares--;
+            return;
+        }
+        TomlPair *next = pair->next;
+        free_value(pair->value, pair->type);
+        mem_free(pair->key);
+        mem_free(pair);
+        pair = next;
+    }
 }
 
 void free_array(TomlArray *array) {
     if (!array) return;
+    if (array->shares > 0) {
+        array->shares--;
+        return;
+    }
     for (size_t i = 0; i < array->count; i++) {
         if (array->types[i] == TOML_VALUE_ARRAY) {
             free_array((TomlArray *)array->values[i]);
         } else {
-            free(array->values[i]);
+            mem_free(array->values[i]);
+        }
+    }
+    mem_free(array->values);
+    mem_free(array->types);
+    mem_free(array->float_precisions);
+    mem_free(array);
+}
+
+void free_value(void *value, TomlValueType type) {
+    if (type == TOML_VALUE_ARRAY) {
+        free_array((TomlArray *)value);
+    } else {
+        mem_free(value);
+    }
+}
+
+// Heap copy of a scalar value as the setters receive it
+void *copy_value(const void *value, TomlValueType type) {
+    void *copy = NULL;
+    switch (type) {
+        case TOML_VALUE_STRING:
+            copy = mem_strdup((const char *)value);
+            break;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL: // Booleans stored as integers
+            copy = mem_malloc(sizeof(int));
+            if (copy) *(int *)copy = *(const int *)value;
+            break;
+        case TOML_VALUE_FLOAT:
+            copy = mem_malloc(sizeof(float));
+            if (copy) *(float *)copy = *(const float *)value;
+            break;
+        default:
+            break; // Unsupported type
+    }
+    return copy;
+}
+
+size_t float_precision(float value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.10f", value);
+    char *dot = strchr(buffer, '.');
+    return dot ? strlen(dot + 1) : 0;
+}
+
+// Make room for count values. The precision array always grows along with the
+// values so it can be indexed by any valid position.
+int array_reserve(TomlArray *array, size_t count) {
+    if (count == 0) return 0;
+
+    void **new_values = mem_realloc(array->values, sizeof(void *) * count);
+    if (!new_values) return -1;
+    array->values = new_values;
+
+    TomlValueType *new_types = mem_realloc(array->types, sizeof(TomlValueType) * count);
+    if (!new_types) return -1;
+    array->types = new_types;
+
+    size_t *new_precisions = mem_realloc(array->float_precisions, sizeof(size_t) * count);
+    if (!new_precisions) return -1;
+    array->float_precisions = new_precisions;
+
+    return 0;
+}
+
+// The store functions bump the document's generation after the tree has
+// changed, and only if it has. A reader that sees the new generation, like an
+// overlay refilling its cache, then also sees the new value. Staged changes
+// leave it alone, the commit bumps it once they are applied.
+int store_pair_value(TomlTable *root, TomlTable *table, TomlPair *pair, void *new_value) {
+    TomlValueType type = pair->type;
+
+    autosave_lock(root);
+    pair = unshare_pair(root, table, pair);
+    if (!pair) {
+        autosave_unlock(root, 0);
+        free_value(new_value, type);
+        return -1; // Memory allocation failed
+    }
+
+    if (root->doc && root->doc->txn) {
+        autosave_unlock(root, 0);
+        return txn_stage(root->doc->txn, TXN_SET_VALUE, table, pair, 0, new_value, type, 0);
+    }
+
+    uint64_t old_hash = pair_hash(table, pair);
+    void *old_value = pair->value;
+    pair->value = new_value;
+    uint64_t new_hash = pair_hash(table, pair);
+    table_hash_update(table, old_hash, new_hash);
+    indexes_changed(table, pair, old_value, new_hash - old_hash);
+    if (root->doc) root->doc->generation++;
+    autosave_unlock(root, 1);
+    free_value(old_value, type);
+    return 0;
+}
+
+int store_array_value(TomlTable *root, TomlTable *table, TomlPair *pair, size_t index, void *new_value, TomlValueType type, size_t precision) {
+    autosave_lock(root);
+    pair = unshare_pair(root, table, pair);
+    if (!pair) {
+        autosave_unlock(root, 0);
+        free_value(new_value, type);
+        return -1; // Memory allocation failed
+    }
+    TomlArray *array = (TomlArray *)pair->value;
+
+    if (root->doc && root->doc->txn) {
+        autosave_unlock(root, 0);
+        if (index >= txn_array_count(root->doc->txn, pair)) {
+            free_value(new_value, type);
+            return -1; // Index out of bounds, counting staged additions
+        }
+        return txn_stage(root->doc->txn, TXN_ARRAY_SET, table, pair, index, new_value, type, precision);
+    }
+
+    // Reserving the current size makes sure the precision array covers every slot
+    if (index >= array->count || array_reserve(array, array->count) != 0) {
+        autosave_unlock(root, 0);
+        free_value(new_value, type);
+        return -1;
+    }
+
+    uint64_t old_hash = pair_hash(table, pair);
+    free_value(array->values[index], array->types[index]);
+    array->values[index] = new_value;
+    array->types[index] = type;
+    array->float_precisions[index] = precision;
+    uint64_t new_hash = pair_hash(table, pair);
+    table_hash_update(table, old_hash, new_hash);
+    indexes_changed(table, pair, NULL, new_hash - old_hash);
+    if (root->doc) root->doc->generation++;
+    autosave_unlock(root, 1);
+    return 0;
+}
+
+int append_array_value(TomlTable *root, TomlTable *table, TomlPair *pair, void *new_value, TomlValueType type, size_t precision) {
+    autosave_lock(root);
+    pair = unshare_pair(root, table, pair);
+    if (!pair) {
+        autosave_unlock(root, 0);
+        free_value(new_value, type);
+        return -1; // Memory allocation failed
+    }
+    TomlArray *array = (TomlArray *)pair->value;
+
+    if (root->doc && root->doc->txn) {
+        autosave_unlock(root, 0);
+        size_t index = txn_array_count(root->doc->txn, pair);
+        return txn_stage(root->doc->txn, TXN_ARRAY_ADD, table, pair, index, new_value, type, precision);
+    }
+
+    size_t grown_bytes = (array->count + 1) * (sizeof(void *) + sizeof(TomlValueType) + sizeof(size_t));
+    TRACE(array__grow__begin, TOML_TRACE_ARRAY_GROW, 0, table->name, pair->key, grown_bytes, array->count + 1);
+    int reserved = array_reserve(array, array->count + 1);
+    TRACE(array__grow__end, TOML_TRACE_ARRAY_GROW, 1, table->name, pair->key, reserved == 0 ? grown_bytes : 0, array->count + 1);
+    if (reserved != 0) {
+        autosave_unlock(root, 0);
+        free_value(new_value, type);
+        return -1;
+    }
+
+    uint64_t old_hash = pair_hash(table, pair);
+    array->values[array->count] = new_value;
+    array->types[array->count] = type;
+    array->float_precisions[array->count] = precision;
+    array->count++;
+    uint64_t new_hash = pair_hash(table, pair);
+    table_hash_update(table, old_hash, new_hash);
+    indexes_changed(table, pair, NULL, new_hash - old_hash);
+    if (root->doc) root->doc->generation++;
+    autosave_unlock(root, 1);
+    return 0;
+}
+
+typedef union {
+    int integer; // INT and BOOL
+    float floating;
+} ScalarValue;
+
+static int is_scalar(TomlValueType type) {
+    return type == TOML_VALUE_INT || type == TOML_VALUE_BOOL || type == TOML_VALUE_FLOAT;
+}
+
+// Swap a new value into the storage of an existing one and return the old one
+static ScalarValue exchange_scalar(void *slot, const void *new_value, TomlValueType type) {
+    ScalarValue old;
+    if (type == TOML_VALUE_FLOAT) {
+        old.floating = atomic_exchange_explicit((_Atomic float *)slot, *(const float *)new_value, memory_order_relaxed);
+    } else {
+        old.integer = atomic_exchange_explicit((_Atomic int *)slot, *(const int *)new_value, memory_order_relaxed);
+    }
+    return old;
+}
+
+// Whether a scalar may be overwritten in place, which setters on several
+// threads may do at once. Only bare documents qualify: staged changes,
+// autosave, the journal, subscriptions and indexes on an enclosing array of
+// tables all keep unsynchronized state, so those take the copying path of
+// store_pair_value and the document stays single-threaded.
+static int in_place_allowed(const TomlTable *root, const TomlTable *table, TomlValueType type) {
+    if (!is_scalar(type)) return 0;
+
+    const TomlDocument *doc = root->doc;
+    if (doc && (doc->txn || doc->autosave || doc->journal || doc->subscriptions)) return 0;
+    for (; table; table = table->parent) {
+        if (table->indexes) return 0;
+    }
+    return 1;
+}
+
+// Scalars are overwritten where they are instead of being freed and replaced,
+// so getters on other threads see either the old or the new value and never
+// freed memory.
+int store_scalar_value(TomlTable *root, TomlTable *table, TomlPair *pair, const void *new_value) {
+    TomlValueType type = pair->type;
+
+    if (!in_place_allowed(root, table, type)) {
+        void *copy = copy_value(new_value, type);
+        return copy ? store_pair_value(root, table, pair, copy) : -1;
+    }
+
+    pair = unshare_pair(root, table, pair);
+    if (!pair) return -1; // Memory allocation failed
+
+    ScalarValue old = exchange_scalar(pair->value, new_value, type);
+    uint64_t old_hash = key_value_hash(table, pair->key, &old, type);
+    uint64_t new_hash = key_value_hash(table, pair->key, new_value, type);
+    table_hash_update(table, old_hash, new_hash);
+    indexes_changed(table, pair, &old, new_hash - old_hash);
+    if (root->doc) root->doc->generation++;
+    return 0;
+}
+
+int store_array_scalar(TomlTable *root, TomlTable *table, TomlPair *pair, size_t index, const void *new_value, TomlValueType type, size_t precision) {
+    const TomlArray *array = (const TomlArray *)pair->value;
+
+    // Changing the type of an element needs new storage
+    if (!in_place_allowed(root, table, type) || index >= array->count || array->types[index] != type) {
+        void *copy = copy_value(new_value, type);
+        return copy ? store_array_value(root, table, pair, index, copy, type, precision) : -1;
+    }
+
+    pair = unshare_pair(root, table, pair);
+    if (!pair) return -1; // Memory allocation failed
+    TomlArray *owned = (TomlArray *)pair->value;
+
+    uint64_t old_hash = pair_hash(table, pair);
+    if (type == TOML_VALUE_FLOAT) {
+        atomic_store_explicit((_Atomic size_t *)&owned->float_precisions[index], precision, memory_order_relaxed);
+    }
+    exchange_scalar(owned->values[index], new_value, type);
+    uint64_t new_hash = pair_hash(table, pair);
+    table_hash_update(table, old_hash, new_hash);
+    indexes_changed(table, pair, NULL, new_hash - old_hash);
+    if (root->doc) root->doc->generation++;
+    return 0;
+}
+
+// FNV-1a, finished with the splitmix64 mixer so sums of hashes stay well spread
+static uint64_t hash_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t hash_bytes(uint64_t seed, const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t h = seed ^ 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    return hash_mix(h);
+}
+
+uint64_t hash_string(uint64_t seed, const char *str) {
+    return hash_bytes(seed, str, strlen(str));
+}
+
+uint64_t table_path_hash(const TomlTable *parent, const char *name) {
+    return hash_string(parent ? parent->path_hash : 0, name);
+}
+
+uint64_t value_hash(const void *value, TomlValueType type) {
+    uint64_t h = hash_mix((uint64_t)type + 1);
+    switch (type) {
+        case TOML_VALUE_STRING:
+            return hash_string(h, (const char *)value);
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL: {
+            int integer = load_int(value);
+            return hash_bytes(h, &integer, sizeof(int));
+        }
+        case TOML_VALUE_FLOAT: {
+            float floating = load_float(value);
+            return hash_bytes(h, &floating, sizeof(float));
+        }
+        case TOML_VALUE_ARRAY: {
+            const TomlArray *array = (const TomlArray *)value;
+            for (size_t i = 0; i < array->count; i++) {
+                h = hash_mix(h ^ value_hash(array->values[i], array->types[i])); // Order matters
+            }
+            return h;
+        }
+    }
+    return h;
+}
+
+// Pairs are seeded with their table's path, so a subtree hash can simply be the
+// sum of its parts and a change can be propagated by adding a delta upwards
+uint64_t pair_hash(const TomlTable *table, const TomlPair *pair) {
+    return key_value_hash(table, pair->key, pair->value, pair->type);
+}
+
+uint64_t key_value_hash(const TomlTable *table, const char *key, const void *value, TomlValueType type) {
+    return hash_mix(table->path_hash + hash_string(value_hash(value, type), key));
+}
+
+void table_hash_update(TomlTable *table, uint64_t old_pair_hash, uint64_t new_pair_hash) {
+    // Atomic adds, so in-place setters of different scalars can run at the same time
+    uint64_t delta = new_pair_hash - old_pair_hash;
+    atomic_fetch_add_explicit((_Atomic uint64_t *)&table->pairs_hash, delta, memory_order_relaxed);
+    for (; table; table = table->parent) {
+        atomic_fetch_add_explicit((_Atomic uint64_t *)&table->hash, delta, memory_order_relaxed);
+    }
+}
+
+// Exact comparison, floats are compared bit for bit like the fingerprints do
+int values_equal(const void *a, TomlValueType a_type, const void *b, TomlValueType b_type) {
+    if (a_type != b_type) return 0;
+
+    switch (a_type) {
+        case TOML_VALUE_STRING:
+            return strcmp((const char *)a, (const char *)b) == 0;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL:
+            return *(const int *)a == *(const int *)b;
+        case TOML_VALUE_FLOAT:
+            return memcmp(a, b, sizeof(float)) == 0;
+        case TOML_VALUE_ARRAY: {
+            const TomlArray *array_a = (const TomlArray *)a;
+            const TomlArray *array_b = (const TomlArray *)b;
+            if (array_a->count != array_b->count) return 0;
+            for (size_t i = 0; i < array_a->count; i++) {
+                if (!values_equal(array_a->values[i], array_a->types[i], array_b->values[i], array_b->types[i])) return 0;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Compute the fingerprints of a list of tables and everything below them
+void rehash_tables(TomlTable *table) {
+    for (; table; table = table->next) {
+        table->pairs_hash = 0;
+        for (const TomlPair *pair = table->pairs; pair; pair = pair->next) {
+            table->pairs_hash += pair_hash(table, pair);
+        }
+
+        rehash_tables(table->subtables);
+        rehash_tables(table->array_of_tables);
+
+        table->hash = hash_mix(table->path_hash) + table->pairs_hash;
+        for (const TomlTable *child = table->subtables; child; child = child->next) {
+            table->hash += child->hash;
+        }
+        for (const TomlTable *element = table->array_of_tables; element; element = element->next) {
+            table->hash += element->hash;
         }
     }
-    free(array->values);
-    free(array->types);
-    free(array->float_precisions);
-    free(array);
 }
 
 TomlTable *find_table(TomlTable *root, const char *name) {
@@ -549,13 +642,18 @@ TomlTable *find_table(TomlTable *root, const char *name) {
 }
 
 TomlTable *find_table_recursive(TomlTable *root, const char *name) {
+    return find_table_recursive_n(root, name, strlen(name));
+}
+
+// Same as find_table_recursive but matches a name that is not NUL terminated
+TomlTable *find_table_recursive_n(TomlTable *root, const char *name, size_t len) {
     while (root) {
-        if (strcmp(root->name, name) == 0) {
+        if (strncmp(root->name, name, len) == 0 && root->name[len] == '\0') {
             return root;
         }
 
         // Search in subtables if not found at the current level
-        TomlTable *found_in_subtable = find_table_recursive(root->subtables, name);
+        TomlTable *found_in_subtable = find_table_recursive_n(root->subtables, name, len);
         if (found_in_subtable) {
             return found_in_subtable;
         }
@@ -565,8 +663,164 @@ TomlTable *find_table_recursive(TomlTable *root, const char *name) {
     return NULL;
 }
 
-void write_table_to_file(FILE *file, const TomlTable *table, int indent, const char *parent_name) {
-    if (!file || !table) return; // Ensure valid pointers
+TomlPair *find_pair(const TomlTable *table, const char *key) {
+    TomlPair *pair = table->pairs;
+    while (pair) {
+        if (strcmp(pair->key, key) == 0) {
+            return pair;
+        }
+        pair = pair->next;
+    }
+    return NULL;
+}
+
+// Element of an array container by position, NULL when out of range
+const TomlTable *aot_element(const TomlTable *container, size_t index) {
+    if (container->elements) {
+        return index < container->element_count ? container->elements[index] : NULL;
+    }
+
+    // Trees built without the index
+    const TomlTable *element = container->array_of_tables;
+    while (element && index--) element = element->next;
+    return element;
+}
+
+void fill_pair_entry(TomlPairEntry *entry, const TomlPair *pair) {
+    entry->key = pair->key;
+    entry->type = pair->type;
+    switch (pair->type) {
+        case TOML_VALUE_STRING:
+            entry->value.string = (const char *)pair->value;
+            break;
+        case TOML_VALUE_INT:
+            entry->value.integer = load_int(pair->value);
+            break;
+        case TOML_VALUE_FLOAT:
+            entry->value.floating = load_float(pair->value);
+            break;
+        case TOML_VALUE_BOOL:
+            entry->value.boolean = load_int(pair->value);
+            break;
+        case TOML_VALUE_ARRAY:
+            entry->value.array = pair->value;
+            break;
+    }
+}
+
+// Find a key below a table path the way the getters see it. Overlay handles
+// resolve through their layers, image handles read the flat image.
+static const void *find_value(const TomlTable *root, const char *table_path, const char *key, TomlValueType *type) {
+    if (root->doc && root->doc->overlay) {
+        return overlay_find_value(root->doc->overlay, table_path, key, type);
+    }
+    if (root->doc && root->doc->image) {
+        return image_find_value(root->doc->image, table_path, key, type);
+    }
+
+    const TomlPair *pair;
+    if (root->doc && !root->doc->pool) {
+        pair = cache_find_pair(root, table_path, key);
+    } else {
+        // Embedded trees never change, pool documents have no room for a cache
+        const TomlTable *table = resolve_table_path(root, table_path);
+        pair = table ? find_pair(table, key) : NULL;
+    }
+    if (!pair) return NULL;
+
+    *type = pair->type;
+    return pair->value;
+}
+
+const void *lookup_value(const TomlTable *root, const char *table_path, const char *key, TomlValueType *type) {
+    TRACE(lookup__begin, TOML_TRACE_LOOKUP, 0, table_path, key, 0, 0);
+    const void *value = find_value(root, table_path, key, type);
+    TRACE(lookup__end, TOML_TRACE_LOOKUP, 1, table_path, key, 0, value != NULL);
+    return value;
+}
+
+size_t array_count(const void *array_handle) {
+    const TomlArray *array = (const TomlArray *)array_handle;
+    return array->flat ? image_array_count(array_handle) : array->count;
+}
+
+// Element of an array handle, which is a TomlArray or an array in a flat image.
+// value and precision may be NULL.
+int array_element(const void *array_handle, size_t index, TomlValueType *type, const void **value, size_t *precision) {
+    if (!array_handle) return -1;
+
+    const TomlArray *array = (const TomlArray *)array_handle;
+    if (array->flat) return image_array_element(array_handle, index, type, value, precision);
+
+    if (index >= array->count) return -1;
+    *type = array->types[index];
+    if (value) *value = array->values[index];
+    if (precision) {
+        *precision = array->types[index] == TOML_VALUE_FLOAT
+            ? atomic_load_explicit((const _Atomic size_t *)&array->float_precisions[index], memory_order_relaxed)
+            : 0;
+    }
+    return 0;
+}
+
+// Walk a dotted table path (e.g. "integration.mqtt") like the getters do, but
+// without copying and tokenizing the path string
+// Parse "[N]" after a segment name. Returns the number of characters consumed,
+// 0 when there is no index and -1 when it is malformed.
+static int parse_element_index(const char *text, size_t *index) {
+    if (*text != '[') return 0;
+
+    const char *c = text + 1;
+    size_t position = 0;
+    if (!isdigit((unsigned char)*c)) return -1;
+    while (isdigit((unsigned char)*c)) {
+        if (position > (SIZE_MAX - 9) / 10) return -1; // Too large to be an index
+        position = position * 10 + (size_t)(*c - '0');
+        c++;
+    }
+    if (*c != ']' || (c[1] != '.' && c[1] != '\0')) return -1;
+
+    *index = position;
+    return (int)(c + 1 - text);
+}
+
+// A segment may pick an array-of-tables element by position, as in
+// "device[2].radio", the form tomlinc_diff reports and queries accept
+TomlTable *resolve_table_path(const TomlTable *root, const char *table_path) {
+    TomlTable *current_table = (TomlTable *)root;
+    const char *token = table_path;
+
+    while (current_table && *token) {
+        if (*token == '.') {
+            token++; // Empty segments are skipped, as strtok would
+            continue;
+        }
+        size_t len = strcspn(token, ".[");
+        if (current_table->is_array_of_tables_element) {
+            // Stay inside the element, its next pointer leads to the following element
+            int is_self = strncmp(current_table->name, token, len) == 0 && current_table->name[len] == '\0';
+            current_table = is_self ? current_table : find_table_recursive_n(current_table->subtables, token, len);
+        } else {
+            current_table = find_table_recursive_n(current_table, token, len);
+        }
+        token += len;
+
+        size_t index;
+        int consumed = parse_element_index(token, &index);
+        if (consumed < 0) return NULL;
+        if (consumed > 0) {
+            if (!current_table || !current_table->is_array_container) return NULL;
+            current_table = (TomlTable *)aot_element(current_table, index);
+            token += consumed;
+        }
+    }
+    return current_table;
+}
+
+// Returns the number of tables and pairs written
+size_t write_table_to_file(FILE *file, const TomlTable *table, int indent, const char *parent_name) {
+    size_t nodes = 0;
+    if (!file || !table) return nodes; // Ensure valid pointers
 
     while (table) {
         char full_name[512] = {0};
@@ -575,7 +829,7 @@ void write_table_to_file(FILE *file, const TomlTable *table, int indent, const c
         if (parent_name && *parent_name) {
             if (snprintf(full_name, sizeof(full_name), "%s.%s", parent_name, table->name) >= sizeof(full_name)) {
                 fprintf(stderr, "DEBUG: Full name truncated, potential overflow.\n");
-                return;
+                return nodes;
             }
         } else {
             strncpy(full_name, table->name, sizeof(full_name) - 1);
@@ -584,6 +838,7 @@ void write_table_to_file(FILE *file, const TomlTable *table, int indent, const c
         // Print table header
         for (int i = 0; i < indent; i++) fprintf(file, "  ");
         fprintf(file, "[%s]\n", full_name);
+        nodes++;
 
         // Print key-value pairs
         TomlPair *pair = table->pairs;
@@ -601,13 +856,13 @@ void write_table_to_file(FILE *file, const TomlTable *table, int indent, const c
                     fprintf(file, "\"%s\"\n", (char *)pair->value);
                     break;
                 case TOML_VALUE_INT:
-                    fprintf(file, "%d\n", *(int *)pair->value);
+                    fprintf(file, "%d\n", load_int(pair->value));
                     break;
                 case TOML_VALUE_FLOAT:
-                    fprintf(file, "%.6g\n", *(float *)pair->value);
+                    fprintf(file, "%.6g\n", load_float(pair->value));
                     break;
                 case TOML_VALUE_BOOL:
-                    fprintf(file, "%s\n", *(int *)pair->value ? "true" : "false");
+                    fprintf(file, "%s\n", load_int(pair->value) ? "true" : "false");
                     break;
                 case TOML_VALUE_ARRAY: {
                     TomlArray *array = (TomlArray *)pair->value;
@@ -617,11 +872,11 @@ void write_table_to_file(FILE *file, const TomlTable *table, int indent, const c
                         if (array->types[i] == TOML_VALUE_STRING) {
                             fprintf(file, "\"%s\"", (char *)array->values[i]);
                         } else if (array->types[i] == TOML_VALUE_INT) {
-                            fprintf(file, "%d", *(int *)array->values[i]);
+                            fprintf(file, "%d", load_int(array->values[i]));
                         } else if (array->types[i] == TOML_VALUE_FLOAT) {
-                            fprintf(file, "%.6g", *(float *)array->values[i]);
+                            fprintf(file, "%.6g", load_float(array->values[i]));
                         } else if (array->types[i] == TOML_VALUE_BOOL) {
-                            fprintf(file, "%s", *(int *)array->values[i] ? "true" : "false");
+                            fprintf(file, "%s", load_int(array->values[i]) ? "true" : "false");
                         }
                     }
                     fprintf(file, "]\n");
@@ -630,19 +885,21 @@ void write_table_to_file(FILE *file, const TomlTable *table, int indent, const c
                 default:
                     fprintf(stderr, "DEBUG: Unknown pair type: %d\n", pair->type);
             }
+            nodes++;
             pair = pair->next;
         }
 
         // Print subtables
         if (table->subtables) {
-            write_table_to_file(file, table->subtables, indent + 1, full_name);
+            nodes += write_table_to_file(file, table->subtables, indent + 1, full_name);
         }
 
         // Print array-of-tables
         if (table->array_of_tables) {
-            write_table_to_file(file, table->array_of_tables, indent + 1, full_name);
+            nodes += write_table_to_file(file, table->array_of_tables, indent + 1, full_name);
         }
 
         table = table->next;
     }
+    return nodes;
 }
\ No newline at end of file
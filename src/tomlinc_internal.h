@@ -4,12 +4,16 @@
 #include "tomlinc.h"
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 typedef struct TomlArray {
+    uint32_t flat; // Always 0 here, set in the arrays of flat images (tomlinc_image.c)
     void **values;
     TomlValueType *types;
     size_t *float_precisions;
     size_t count;
+    size_t shares; // Owners beyond the first, see tomlinc_fork
 } TomlArray;
 
 typedef struct TomlPair {
@@ -17,8 +21,44 @@ typedef struct TomlPair {
     void *value;
     TomlValueType type;
     struct TomlPair *next;
+    size_t shares; // Owners beyond the first, see tomlinc_fork
 } TomlPair;
 
+typedef enum {
+    TXN_SET_VALUE,
+    TXN_ARRAY_SET,
+    TXN_ARRAY_ADD
+} TomlTxnOpKind;
+
+typedef struct TomlOverlay TomlOverlay;
+typedef struct TomlAutosave TomlAutosave;
+typedef struct TomlJournal TomlJournal;
+typedef struct TomlSubscriptions TomlSubscriptions;
+typedef struct TomlLookupCache TomlLookupCache;
+typedef struct TomlPool TomlPool;
+
+// A flat, position-independent copy of a document (tomlinc_image.c)
+typedef struct TomlImage {
+    const unsigned char *base;
+    size_t size;
+    void (*release)(struct TomlImage *image); // Frees the image and whatever holds its memory
+} TomlImage;
+
+// Per-document state, owned by the root table returned from tomlinc_open_file
+typedef struct TomlDocument {
+    TomlTxn *txn;                     // Open transaction, mutations are staged into it
+    int forked;                       // Shares nodes with another document, copy before writing
+    _Atomic uint64_t generation;      // Bumped by every mutation, lets caches detect changes
+    _Atomic uint64_t layout;          // Bumped when nodes are replaced, see tomlinc_cache.c
+    TomlLookupCache *_Atomic cache;   // Getter lookups, created by the first one
+    TomlOverlay *overlay;             // Set on overlay handles, lookups go through the layers
+    TomlImage *image;                 // Set on image handles, lookups read the flat image
+    TomlAutosave *autosave;           // Background writer, told about every applied change
+    TomlJournal *journal;             // Write-ahead log of the setter calls
+    TomlSubscriptions *subscriptions; // Listeners told about the setter calls
+    TomlPool *pool;                   // Set on documents in a caller's memory, see tomlinc_pool.c
+} TomlDocument;
+
 typedef struct TomlTable {
     char *name;
     TomlPair *pairs;
@@ -30,20 +70,179 @@ typedef struct TomlTable {
 
     int is_array_of_tables_element;
     int is_array_container; // Add this flag
+
+    // Containers also keep their elements in a vector for access by index
+    struct TomlTable **elements;
+    size_t element_count;
+    size_t element_capacity;
+    TomlAotIndex *indexes; // Kept up to date by the setters, see tomlinc_index.c
+
+    TomlDocument *doc; // Only set on the root table
+    size_t shares;     // Owners beyond the first, see tomlinc_fork
+
+    // Content fingerprints, kept up to date by the mutation entry points.
+    // hash covers the whole subtree, pairs_hash only this table's pairs.
+    struct TomlTable *parent;
+    uint64_t path_hash;
+    uint64_t pairs_hash;
+    uint64_t hash;
 } TomlTable;
 
+// Memory for document nodes (tomlinc_pool.c). Only builds with
+// TOMLINC_STATIC_POOL route it through the active pool, everything else gets
+// the C library functions themselves.
+#ifdef TOMLINC_STATIC_POOL
+void *mem_malloc(size_t size);
+void *mem_calloc(size_t count, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+char *mem_strdup(const char *str);
+void mem_free(void *ptr);
+TomlPool *pool_enter(const TomlTable *root); // Make root's pool active, if it has one
+void pool_leave(TomlPool *previous);
+#else
+#define mem_malloc malloc
+#define mem_calloc calloc
+#define mem_realloc realloc
+#define mem_strdup strdup
+#define mem_free free
+#define pool_enter(root) ((void)(root), (TomlPool *)NULL)
+#define pool_leave(previous) ((void)(previous))
+#endif
+
 // Private helper functions
+TomlTable *parse_file(const char *filename, char *line, size_t line_size, const char *const *table_prefixes, size_t prefix_count);
 char *trim_whitespace(char *str);
 TomlPair *parse_pair(const char *line, FILE *file);
-static TomlArray *parse_array(const char *line, FILE *file);
+void skip_pair(const char *line, FILE *file);
 TomlTable *find_or_create_table(TomlTable **root, const char *name);
 TomlTable *find_or_create_array_of_tables(TomlTable **root, const char *name);
+TomlTable *append_array_of_tables_element(TomlTable *container);
 void free_table(TomlTable *table);
+void free_tables(TomlTable *table);
+void free_pairs(TomlPair *pair);
 void free_array(TomlArray *array);
+void free_value(void *value, TomlValueType type);
+void *copy_value(const void *value, TomlValueType type);
+size_t float_precision(float value);
+int array_reserve(TomlArray *array, size_t count);
+int save_file_durable(const TomlTable *root, const char *filename);
+int write_file_durable(const char *filename, const char *data, size_t size);
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t length; // Total output length, may exceed size
+} BufferSink;
+
+int buffer_sink(const char *data, size_t len, void *userdata);
+
+// Mutation entry points for the setters, they take ownership of new_value
+int store_pair_value(TomlTable *root, TomlTable *table, TomlPair *pair, void *new_value);
+int store_array_value(TomlTable *root, TomlTable *table, TomlPair *pair, size_t index, void *new_value, TomlValueType type, size_t precision);
+int append_array_value(TomlTable *root, TomlTable *table, TomlPair *pair, void *new_value, TomlValueType type, size_t precision);
+
+// INT, BOOL and FLOAT values are overwritten in place, new_value is only read
+int store_scalar_value(TomlTable *root, TomlTable *table, TomlPair *pair, const void *new_value);
+int store_array_scalar(TomlTable *root, TomlTable *table, TomlPair *pair, size_t index, const void *new_value, TomlValueType type, size_t precision);
+
+// Scalars can change under a reader on another thread, so they are read with
+// atomic loads. Relaxed is enough: each value stands on its own.
+static inline int load_int(const void *value) {
+    return atomic_load_explicit((const _Atomic int *)value, memory_order_relaxed);
+}
+
+static inline float load_float(const void *value) {
+    return atomic_load_explicit((const _Atomic float *)value, memory_order_relaxed);
+}
+
+// Copy-on-write between forked documents (tomlinc_cow.c)
+TomlTable *resolve_table_path_for_write(TomlTable *root, const char *table_path);
+TomlPair *unshare_pair(TomlTable *root, TomlTable *table, TomlPair *pair);
+
+// Fingerprints
+uint64_t hash_bytes(uint64_t seed, const void *data, size_t len);
+uint64_t hash_string(uint64_t seed, const char *str);
+uint64_t table_path_hash(const TomlTable *parent, const char *name);
+uint64_t value_hash(const void *value, TomlValueType type);
+int values_equal(const void *a, TomlValueType a_type, const void *b, TomlValueType b_type);
+uint64_t pair_hash(const TomlTable *table, const TomlPair *pair);
+uint64_t key_value_hash(const TomlTable *table, const char *key, const void *value, TomlValueType type);
+void table_hash_update(TomlTable *table, uint64_t old_pair_hash, uint64_t new_pair_hash);
+void rehash_tables(TomlTable *table);
+
+// Transactions (tomlinc_txn.c)
+int txn_stage(TomlTxn *txn, TomlTxnOpKind kind, TomlTable *table, TomlPair *pair, size_t index, void *value, TomlValueType type, size_t precision);
+size_t txn_array_count(const TomlTxn *txn, const TomlPair *pair);
+void txn_discard(TomlTxn *txn);
+
+// Flat images (tomlinc_image.c)
+unsigned char *image_build(const TomlTable *root, uint64_t generation, size_t *size);
+int image_check(const unsigned char *base, size_t size);
+uint64_t image_generation(const unsigned char *base);
+const void *image_find_value(const TomlImage *image, const char *table_path, const char *key, TomlValueType *type);
+size_t image_array_count(const void *array_handle);
+int image_array_element(const void *array_handle, size_t index, TomlValueType *type, const void **value, size_t *precision);
+TomlTable *image_handle_create(TomlImage *image);
+
+// Background saving (tomlinc_autosave.c)
+void autosave_lock(TomlTable *root);
+void autosave_unlock(TomlTable *root, int changed);
+
+// Mutation journal (tomlinc_journal.c)
+void journal_record(TomlTable *root, TomlTxnOpKind kind, const char *table_path, const char *key, size_t index, const void *value, TomlValueType type);
+void journal_txn_end(TomlTable *root, int committed);
+
+// Element indexes (tomlinc_index.c). Called after table_hash_update with the
+// same delta; old_value is the replaced value of a pair whose value was
+// swapped as a whole, NULL for changes inside arrays.
+void indexes_changed(const TomlTable *table, const TomlPair *pair, const void *old_value, uint64_t delta);
+void indexes_detach(TomlTable *container);
+
+// Change subscriptions (tomlinc_subscribe.c)
+void subscriptions_notify(TomlTable *root, const char *table_path, const char *key);
+void subscriptions_txn_end(TomlTable *root, int committed);
+void subscriptions_free(TomlSubscriptions *subscriptions);
+
+// Tracing (tomlinc_trace.c). Every span is a USDT probe pair in provider
+// tomlinc when sys/sdt.h is available (a nop until a tracer attaches) and goes
+// to the trace callback when one is set, at the cost of one load otherwise.
+extern _Atomic(TomlTraceCallback) trace_callback;
+void trace_emit(TomlTraceSpan span, int end, const char *name, const char *key, size_t bytes, size_t nodes);
+
+#ifdef TOMLINC_HAVE_SDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(probe, name, key, bytes, nodes) STAP_PROBE4(tomlinc, probe, name, key, bytes, nodes)
+#else
+#define TRACE_PROBE(probe, name, key, bytes, nodes) ((void)0)
+#endif
+
+#define TRACE(probe, span, end, name, key, bytes, nodes)                          \
+    do {                                                                         \
+        TRACE_PROBE(probe, name, key, bytes, nodes);                             \
+        if (atomic_load_explicit(&trace_callback, memory_order_relaxed)) {       \
+            trace_emit(span, end, name, key, bytes, nodes);                      \
+        }                                                                        \
+    } while (0)
+
+// Getter lookup cache (tomlinc_cache.c)
+const TomlPair *cache_find_pair(const TomlTable *root, const char *table_path, const char *key);
+void cache_free(TomlDocument *doc);
+
+// Layered overlays (tomlinc_overlay.c)
+const void *overlay_find_value(TomlOverlay *overlay, const char *table_path, const char *key, TomlValueType *type);
+void overlay_free(TomlOverlay *overlay);
 
 // Used internally but also helpful for the public API implementation
 TomlTable *find_table(TomlTable *root, const char *name);
 TomlTable *find_table_recursive(TomlTable *root, const char *path);
-void write_table_to_file(FILE *file, const TomlTable *table, int indent, const char *parent_name);
+TomlTable *find_table_recursive_n(TomlTable *root, const char *name, size_t len);
+TomlTable *resolve_table_path(const TomlTable *root, const char *table_path);
+TomlPair *find_pair(const TomlTable *table, const char *key);
+const TomlTable *aot_element(const TomlTable *container, size_t index);
+const void *lookup_value(const TomlTable *root, const char *table_path, const char *key, TomlValueType *type);
+size_t array_count(const void *array_handle);
+int array_element(const void *array_handle, size_t index, TomlValueType *type, const void **value, size_t *precision);
+void fill_pair_entry(TomlPairEntry *entry, const TomlPair *pair);
+size_t write_table_to_file(FILE *file, const TomlTable *table, int indent, const char *parent_name);
 
 #endif // TOMLINC_INTERNAL_H
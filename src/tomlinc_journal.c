@@ -0,0 +1,496 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Write-ahead journal of setter calls, kept in "<file>.journal" next to the
+// TOML file. Every change is appended as one record and the file is synced
+// in groups. Opening replays the journal over the file. Once the journal
+// grows past its limit it is renamed to "<file>.journal.old" and a fresh one
+// is started. The document is printed to memory right there, and a background
+// thread writes that copy over the file and then deletes the old journal.
+// Compaction rewrites the file with write_table_to_file, so documents it
+// cannot print back yet, with arrays of tables or nested arrays, are refused.
+//
+// Records are idempotent: array additions carry the index they appended at
+// and overwrite that slot if it already exists. Replaying a journal over a
+// file that already contains its changes, as after a crash during
+// compaction, gives the same document.
+
+#define JOURNAL_MAGIC 0x4c4a4d54u // "TMJL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_GROUP_RECORDS 64
+#define JOURNAL_GROUP_NS 5000000u // 5 ms
+#define JOURNAL_DEFAULT_COMPACT_SIZE (1u << 20)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} JournalHeader;
+
+// Record layout, native byte order:
+//   u32 payload length, u32 checksum of the payload
+//   payload: u8 kind, u8 value type, u16 zero, u32 index,
+//            u32 length + table path, u32 length + key,
+//            value: i32 (int, bool), f32 (float) or u32 length + bytes (string)
+
+struct TomlJournal {
+    char *filename;
+    char *journal_path;
+    char *old_path;
+    int fd;
+    size_t size;              // Bytes in the journal file
+    size_t compact_size;
+
+    unsigned char *buffer;    // Records of an open transaction, written on commit
+    size_t length;
+    size_t capacity;
+
+    size_t unsynced;          // Records written since the last fdatasync
+    uint64_t last_sync;
+    int failed;               // A write, sync or compaction failed
+
+    pthread_t thread;
+    int compacting;
+    int compaction_disabled;  // A compaction failed, the old journal must stay
+    atomic_int compact_done;
+    int compact_result;
+    char *snapshot;           // The document as printed when the compaction started
+    size_t snapshot_size;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static char *path_with_suffix(const char *path, const char *suffix) {
+    char *out = malloc(strlen(path) + strlen(suffix) + 1);
+    if (out) sprintf(out, "%s%s", path, suffix);
+    return out;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        bytes += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int reserve(TomlJournal *journal, size_t len) {
+    if (journal->length + len <= journal->capacity) return 0;
+
+    size_t new_capacity = journal->capacity ? journal->capacity * 2 : 256;
+    while (new_capacity < journal->length + len) new_capacity *= 2;
+    unsigned char *new_buffer = realloc(journal->buffer, new_capacity);
+    if (!new_buffer) return -1;
+    journal->buffer = new_buffer;
+    journal->capacity = new_capacity;
+    return 0;
+}
+
+static void put(TomlJournal *journal, const void *data, size_t len) {
+    memcpy(journal->buffer + journal->length, data, len);
+    journal->length += len;
+}
+
+static void put_u32(TomlJournal *journal, uint32_t value) {
+    put(journal, &value, sizeof(value));
+}
+
+static void put_string(TomlJournal *journal, const char *str) {
+    uint32_t len = (uint32_t)strlen(str);
+    put_u32(journal, len);
+    put(journal, str, len);
+}
+
+// Append one encoded record to the buffer
+static int encode_record(TomlJournal *journal, TomlTxnOpKind kind, const char *table_path, const char *key,
+                         size_t index, const void *value, TomlValueType type) {
+    size_t value_size = type == TOML_VALUE_STRING ? 4 + strlen((const char *)value) : 4;
+    size_t payload = 8 + 4 + strlen(table_path) + 4 + strlen(key) + value_size;
+    if (payload > UINT32_MAX || index > UINT32_MAX || reserve(journal, 8 + payload) != 0) return -1;
+
+    put_u32(journal, (uint32_t)payload);
+    size_t checksum_at = journal->length;
+    put_u32(journal, 0);
+
+    size_t start = journal->length;
+    unsigned char head[4] = { (unsigned char)kind, (unsigned char)type, 0, 0 };
+    put(journal, head, sizeof(head));
+    put_u32(journal, (uint32_t)index);
+    put_string(journal, table_path);
+    put_string(journal, key);
+    switch (type) {
+        case TOML_VALUE_STRING:
+            put_string(journal, (const char *)value);
+            break;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL:
+        case TOML_VALUE_FLOAT:
+            put(journal, value, 4); // int and float are both 32 bits
+            break;
+        default:
+            journal->length = start - 8;
+            return -1;
+    }
+
+    uint32_t checksum = (uint32_t)hash_bytes(0, journal->buffer + start, payload);
+    memcpy(journal->buffer + checksum_at, &checksum, sizeof(checksum));
+    return 0;
+}
+
+static void sync_journal(TomlJournal *journal) {
+    if (journal->unsynced == 0) return;
+    if (fdatasync(journal->fd) != 0) journal->failed = 1;
+    journal->unsynced = 0;
+    journal->last_sync = now_ns();
+}
+
+static void write_buffer(TomlJournal *journal, size_t records) {
+    if (journal->length == 0) return;
+
+    if (write_all(journal->fd, journal->buffer, journal->length) != 0) journal->failed = 1;
+    journal->size += journal->length;
+    journal->length = 0;
+    journal->unsynced += records;
+
+    // An isolated change is synced at once, a burst once per group
+    if (journal->unsynced >= JOURNAL_GROUP_RECORDS || now_ns() - journal->last_sync >= JOURNAL_GROUP_NS) {
+        sync_journal(journal);
+    }
+}
+
+static int open_journal(TomlJournal *journal, size_t keep) {
+    journal->fd = open(journal->journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal->fd < 0) return -1;
+
+    // Drop a torn record at the end, or start a new file
+    if (keep < sizeof(JournalHeader)) {
+        JournalHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION };
+        if (ftruncate(journal->fd, 0) != 0 || write_all(journal->fd, &header, sizeof(header)) != 0) return -1;
+        keep = sizeof(header);
+    } else if (ftruncate(journal->fd, (off_t)keep) != 0) {
+        return -1;
+    }
+    if (fdatasync(journal->fd) != 0) return -1;
+
+    journal->size = keep;
+    journal->last_sync = now_ns();
+    return 0;
+}
+
+static void *compact_thread(void *arg) {
+    TomlJournal *journal = (TomlJournal *)arg;
+
+    int result = write_file_durable(journal->filename, journal->snapshot, journal->snapshot_size);
+    if (result == 0 && unlink(journal->old_path) != 0) result = -1;
+    journal->compact_result = result;
+    atomic_store_explicit(&journal->compact_done, 1, memory_order_release);
+    return NULL;
+}
+
+// Collect a finished compaction
+static void finish_compaction(TomlJournal *journal, int wait) {
+    if (!journal->compacting) return;
+    if (!wait && !atomic_load_explicit(&journal->compact_done, memory_order_acquire)) return;
+
+    pthread_join(journal->thread, NULL);
+    free(journal->snapshot);
+    journal->snapshot = NULL;
+    journal->compacting = 0;
+    if (journal->compact_result != 0) {
+        journal->failed = 1;
+        journal->compaction_disabled = 1;
+    }
+}
+
+static int print_document(const TomlTable *root, char **data, size_t *size) {
+    FILE *memory = open_memstream(data, size);
+    if (!memory) return -1;
+
+    write_table_to_file(memory, root, 0, NULL);
+    int write_failed = ferror(memory);
+    if (fclose(memory) != 0 || write_failed) {
+        free(*data);
+        return -1;
+    }
+    return 0;
+}
+
+static void start_compaction(TomlTable *root, TomlJournal *journal) {
+    sync_journal(journal);
+
+    // Changes from here on go to a new journal, the snapshot covers the old one
+    char *snapshot;
+    size_t snapshot_size;
+    if (print_document(root, &snapshot, &snapshot_size) != 0) return;
+    close(journal->fd);
+    if (rename(journal->journal_path, journal->old_path) != 0) {
+        free(snapshot);
+        journal->failed = 1;
+        journal->compaction_disabled = 1;
+        journal->fd = open(journal->journal_path, O_WRONLY | O_APPEND);
+        return;
+    }
+    if (open_journal(journal, 0) != 0) journal->failed = 1; // The compaction still covers the old records
+
+    journal->snapshot = snapshot;
+    journal->snapshot_size = snapshot_size;
+    atomic_store_explicit(&journal->compact_done, 0, memory_order_relaxed);
+    if (pthread_create(&journal->thread, NULL, compact_thread, journal) != 0) {
+        // Compact in place instead
+        journal->compact_result = write_file_durable(journal->filename, snapshot, snapshot_size) == 0 && unlink(journal->old_path) == 0 ? 0 : -1;
+        atomic_store_explicit(&journal->compact_done, 1, memory_order_relaxed);
+    }
+    journal->compacting = 1;
+    finish_compaction(journal, 0);
+}
+
+static void maybe_compact(TomlTable *root, TomlJournal *journal) {
+    finish_compaction(journal, 0);
+    if (!journal->compacting && !journal->compaction_disabled && journal->size >= journal->compact_size) {
+        start_compaction(root, journal);
+    }
+}
+
+// Called by the setters after a successful change
+void journal_record(TomlTable *root, TomlTxnOpKind kind, const char *table_path, const char *key,
+                    size_t index, const void *value, TomlValueType type) {
+    TomlJournal *journal = root->doc->journal;
+
+    if (encode_record(journal, kind, table_path, key, index, value, type) != 0) {
+        journal->failed = 1;
+        return;
+    }
+    if (root->doc->txn) return; // Written on commit
+
+    write_buffer(journal, 1);
+    maybe_compact(root, journal);
+}
+
+void journal_txn_end(TomlTable *root, int committed) {
+    TomlJournal *journal = root->doc->journal;
+    if (!committed) {
+        journal->length = 0;
+        return;
+    }
+    write_buffer(journal, JOURNAL_GROUP_RECORDS); // A commit is synced as a whole
+    maybe_compact(root, journal);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Bounds-checked string field, returned as a new C string
+static char *get_string(const unsigned char *payload, size_t size, size_t *pos) {
+    if (size - *pos < 4) return NULL;
+    uint32_t len = get_u32(payload + *pos);
+    *pos += 4;
+    if (size - *pos < len || memchr(payload + *pos, '\0', len)) return NULL;
+    char *str = strndup((const char *)payload + *pos, len);
+    *pos += len;
+    return str;
+}
+
+static void apply_record(TomlTable *root, const unsigned char *payload, size_t size) {
+    if (size < 8) return;
+    TomlTxnOpKind kind = (TomlTxnOpKind)payload[0];
+    TomlValueType type = (TomlValueType)payload[1];
+    size_t index = get_u32(payload + 4);
+
+    size_t pos = 8;
+    char *table_path = get_string(payload, size, &pos);
+    char *key = get_string(payload, size, &pos);
+    char *string = NULL;
+    unsigned char scalar[4];
+    const void *value = scalar;
+
+    if (type == TOML_VALUE_STRING) {
+        value = string = get_string(payload, size, &pos);
+    } else if (size - pos >= 4) {
+        memcpy(scalar, payload + pos, 4);
+        pos += 4;
+    } else {
+        value = NULL;
+    }
+    if (!table_path || !key || !value || pos != size) goto done;
+
+    // Changes whose target no longer exists are skipped
+    if (kind == TXN_SET_VALUE) {
+        if (type == TOML_VALUE_STRING) tomlinc_set_string_value(root, table_path, key, string);
+        if (type == TOML_VALUE_INT) tomlinc_set_int_value(root, table_path, key, *(const int *)value);
+        if (type == TOML_VALUE_BOOL) tomlinc_set_bool_value(root, table_path, key, *(const int *)value);
+        if (type == TOML_VALUE_FLOAT) tomlinc_set_float_value(root, table_path, key, *(const float *)value);
+    } else if (kind == TXN_ARRAY_SET) {
+        tomlinc_array_set_value(root, table_path, key, index, (void *)value, type);
+    } else if (kind == TXN_ARRAY_ADD) {
+        size_t count;
+        void *array = tomlinc_get_array_from_table(root, table_path, key);
+        if (array && tomlinc_get_array_size(array, &count) == 0) {
+            if (index == count) {
+                tomlinc_array_add_value(root, table_path, key, (void *)value, type);
+            } else if (index < count) {
+                tomlinc_array_set_value(root, table_path, key, index, (void *)value, type); // Already applied
+            }
+        }
+    }
+
+done:
+    free(table_path);
+    free(key);
+    free(string);
+}
+
+// Apply the records of a journal file to root. Returns -1 when the file does
+// not exist, otherwise 0 with valid set to the length of the intact part.
+static int replay(TomlTable *root, const char *path, size_t *valid) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+
+    unsigned char *data = NULL;
+    size_t size = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long end = ftell(file);
+        if (end > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc((size_t)end);
+            if (data) size = fread(data, 1, (size_t)end, file);
+        }
+    }
+    fclose(file);
+
+    size_t pos = 0;
+    const JournalHeader *header = (const JournalHeader *)data;
+    if (size >= sizeof(JournalHeader) && header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION) {
+        pos = sizeof(JournalHeader);
+        while (size - pos >= 8) {
+            uint32_t len = get_u32(data + pos);
+            uint32_t checksum = get_u32(data + pos + 4);
+            if (size - pos - 8 < len || (uint32_t)hash_bytes(0, data + pos + 8, len) != checksum) break;
+
+            apply_record(root, data + pos + 8, len);
+            pos += 8 + len;
+        }
+    }
+
+    free(data);
+    if (valid) *valid = pos;
+    return 0;
+}
+
+// write_table_to_file prints arrays of tables as plain tables and drops
+// nested arrays, so a compaction would lose them
+static int prints_back(const TomlTable *table) {
+    for (; table; table = table->next) {
+        if (table->is_array_container) return 0;
+        for (const TomlPair *pair = table->pairs; pair; pair = pair->next) {
+            if (pair->type != TOML_VALUE_ARRAY) continue;
+            const TomlArray *array = (const TomlArray *)pair->value;
+            for (size_t i = 0; i < array->count; i++) {
+                if (array->types[i] == TOML_VALUE_ARRAY) return 0;
+            }
+        }
+        if (!prints_back(table->subtables)) return 0;
+    }
+    return 1;
+}
+
+static void free_journal(TomlJournal *journal) {
+    free(journal->filename);
+    free(journal->journal_path);
+    free(journal->old_path);
+    free(journal->buffer);
+    free(journal);
+}
+
+// Replay the journal of filename over root, which was opened from filename,
+// and journal every change from now on. compact_size is the journal size that
+// triggers a compaction, 0 picks a default.
+int tomlinc_journal_start(TomlTable *root_table, const char *filename, size_t compact_size) {
+    if (!root_table || !filename || !root_table->doc) return -1;
+    if (root_table->doc->overlay || root_table->doc->image || root_table->doc->pool || root_table->doc->txn) return -1;
+    if (root_table->doc->journal) return -1; // Already running
+    if (!prints_back(root_table)) return -1;
+
+    TomlJournal *journal = calloc(1, sizeof(TomlJournal));
+    if (!journal) return -1;
+    journal->fd = -1;
+    journal->compact_size = compact_size ? compact_size : JOURNAL_DEFAULT_COMPACT_SIZE;
+    journal->filename = strdup(filename);
+    journal->journal_path = path_with_suffix(filename, ".journal");
+    journal->old_path = path_with_suffix(filename, ".journal.old");
+    if (!journal->filename || !journal->journal_path || !journal->old_path) {
+        free_journal(journal);
+        return -1;
+    }
+
+    // A compaction was interrupted: the old journal may or may not be in the file yet
+    int interrupted = replay(root_table, journal->old_path, NULL) == 0;
+
+    size_t valid = 0;
+    replay(root_table, journal->journal_path, &valid);
+    if (interrupted) {
+        // Everything is in the document now, finish the compaction here
+        if (save_file_durable(root_table, journal->filename) != 0 || unlink(journal->old_path) != 0) {
+            free_journal(journal);
+            return -1;
+        }
+        valid = 0;
+    }
+
+    if (open_journal(journal, valid) != 0) {
+        if (journal->fd >= 0) close(journal->fd);
+        free_journal(journal);
+        return -1;
+    }
+
+    root_table->doc->journal = journal;
+    maybe_compact(root_table, journal);
+    return 0;
+}
+
+// Sync the journal now. Returns -1 if a write, sync or compaction failed since
+// the last call.
+int tomlinc_journal_sync(TomlTable *root_table) {
+    if (!root_table || !root_table->doc || !root_table->doc->journal) return -1;
+    TomlJournal *journal = root_table->doc->journal;
+
+    sync_journal(journal);
+    finish_compaction(journal, 0);
+
+    int result = journal->failed ? -1 : 0;
+    journal->failed = 0;
+    return result;
+}
+
+// Sync and close the journal, waiting for a running compaction. Changes staged
+// in an open transaction are not journaled.
+int tomlinc_journal_stop(TomlTable *root_table) {
+    if (!root_table || !root_table->doc || !root_table->doc->journal) return -1;
+    TomlJournal *journal = root_table->doc->journal;
+
+    sync_journal(journal);
+    finish_compaction(journal, 1);
+    close(journal->fd);
+
+    int result = journal->failed ? -1 : 0;
+    free_journal(journal);
+    root_table->doc->journal = NULL;
+    return result;
+}
@@ -0,0 +1,215 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// JSON export. The tree is written straight to a caller supplied sink in
+// small pieces; numbers are formatted on the stack and strings are passed
+// through in runs between escapes, so nothing is allocated.
+
+typedef struct {
+    TomlSink sink;
+    void *userdata;
+    int pretty;
+    int failed;
+} JsonWriter;
+
+static void emit(JsonWriter *w, const char *data, size_t len) {
+    if (w->failed || len == 0) return;
+    if (w->sink(data, len, w->userdata) != 0) w->failed = 1;
+}
+
+static void emit_text(JsonWriter *w, const char *text) {
+    emit(w, text, strlen(text));
+}
+
+static void emit_newline(JsonWriter *w, int depth) {
+    static const char spaces[] = "                                ";
+    if (!w->pretty) return;
+
+    emit(w, "\n", 1);
+    for (size_t indent = (size_t)depth * 2; indent > 0;) {
+        size_t chunk = indent < sizeof(spaces) - 1 ? indent : sizeof(spaces) - 1;
+        emit(w, spaces, chunk);
+        indent -= chunk;
+    }
+}
+
+// A table name preceded by the names of the containers it hangs off
+typedef struct KeyPrefix {
+    const struct KeyPrefix *parent;
+    const char *name;
+} KeyPrefix;
+
+// String contents without the quotes
+static void emit_escaped(JsonWriter *w, const char *str) {
+    const char *run = str;
+    for (const char *c = str; *c; c++) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+
+        emit(w, run, (size_t)(c - run));
+        run = c + 1;
+
+        char escape[8];
+        switch (ch) {
+            case '"':  emit(w, "\\\"", 2); break;
+            case '\\': emit(w, "\\\\", 2); break;
+            case '\n': emit(w, "\\n", 2); break;
+            case '\r': emit(w, "\\r", 2); break;
+            case '\t': emit(w, "\\t", 2); break;
+            default:
+                snprintf(escape, sizeof(escape), "\\u%04x", ch);
+                emit(w, escape, 6);
+        }
+    }
+    emit(w, run, strlen(run));
+}
+
+static void emit_string(JsonWriter *w, const char *str) {
+    emit(w, "\"", 1);
+    emit_escaped(w, str);
+    emit(w, "\"", 1);
+}
+
+static void emit_prefix(JsonWriter *w, const KeyPrefix *prefix) {
+    if (!prefix) return;
+    emit_prefix(w, prefix->parent);
+    emit_escaped(w, prefix->name);
+    emit(w, ".", 1);
+}
+
+static void emit_float(JsonWriter *w, float value) {
+    if (!isfinite(value)) {
+        emit(w, "null", 4); // JSON has no NaN or infinity
+        return;
+    }
+
+    // Shortest representation that reads back as the same float
+    char buffer[32];
+    for (int digits = 6; digits <= 9; digits++) {
+        snprintf(buffer, sizeof(buffer), "%.*g", digits, value);
+        if (strtof(buffer, NULL) == value) break;
+    }
+    emit_text(w, buffer);
+}
+
+static void emit_value(JsonWriter *w, const void *value, TomlValueType type, int depth) {
+    char buffer[16];
+
+    switch (type) {
+        case TOML_VALUE_STRING:
+            emit_string(w, (const char *)value);
+            break;
+        case TOML_VALUE_INT:
+            snprintf(buffer, sizeof(buffer), "%d", load_int(value));
+            emit_text(w, buffer);
+            break;
+        case TOML_VALUE_FLOAT:
+            emit_float(w, load_float(value));
+            break;
+        case TOML_VALUE_BOOL:
+            emit_text(w, load_int(value) ? "true" : "false");
+            break;
+        case TOML_VALUE_ARRAY: {
+            const TomlArray *array = (const TomlArray *)value;
+            emit(w, "[", 1);
+            for (size_t i = 0; i < array->count; i++) {
+                if (i) emit(w, ",", 1);
+                emit_newline(w, depth + 1);
+                emit_value(w, array->values[i], array->types[i], depth + 1);
+            }
+            if (array->count) emit_newline(w, depth);
+            emit(w, "]", 1);
+            break;
+        }
+    }
+}
+
+static void emit_key(JsonWriter *w, const KeyPrefix *prefix, const char *key, int first, int depth) {
+    if (!first) emit(w, ",", 1);
+    emit_newline(w, depth);
+    emit(w, "\"", 1);
+    emit_prefix(w, prefix);
+    emit_escaped(w, key);
+    emit(w, "\"", 1);
+    emit(w, w->pretty ? ": " : ":", w->pretty ? 2 : 1);
+}
+
+static void emit_members(JsonWriter *w, const TomlTable *list, const KeyPrefix *prefix, int first, int depth);
+
+// A table becomes an object of its pairs followed by its subtables
+static void emit_table(JsonWriter *w, const TomlTable *table, int depth) {
+    int first = 1;
+
+    emit(w, "{", 1);
+    for (const TomlPair *pair = table->pairs; pair; pair = pair->next) {
+        emit_key(w, NULL, pair->key, first, depth + 1);
+        emit_value(w, pair->value, pair->type, depth + 1);
+        first = 0;
+    }
+    emit_members(w, table->subtables, NULL, first, depth + 1);
+    if (table->pairs || table->subtables) emit_newline(w, depth);
+    emit(w, "}", 1);
+}
+
+// Tables below an array of tables, such as [[device.channel]], hang off the
+// container rather than one of its elements. An array has no room for them, so
+// they follow it as "device.channel", the path the getters take to reach them.
+static void emit_members(JsonWriter *w, const TomlTable *list, const KeyPrefix *prefix, int first, int depth) {
+    for (const TomlTable *table = list; table && !w->failed; table = table->next) {
+        emit_key(w, prefix, table->name, first, depth);
+        first = 0;
+
+        if (!table->is_array_container) {
+            emit_table(w, table, depth);
+            continue;
+        }
+
+        // Arrays of tables become arrays of objects
+        emit(w, "[", 1);
+        for (const TomlTable *element = table->array_of_tables; element; element = element->next) {
+            if (element != table->array_of_tables) emit(w, ",", 1);
+            emit_newline(w, depth + 1);
+            emit_table(w, element, depth + 1);
+        }
+        if (table->array_of_tables) emit_newline(w, depth);
+        emit(w, "]", 1);
+
+        KeyPrefix container = { prefix, table->name };
+        emit_members(w, table->subtables, &container, 0, depth);
+    }
+}
+
+int tomlinc_to_json(const TomlTable *root_table, int pretty, TomlSink sink, void *userdata) {
+    if (!sink) return -1;
+    if (root_table && root_table->doc && root_table->doc->image) return -1; // No tree to walk
+
+    JsonWriter w = { sink, userdata, pretty, 0 };
+    emit(&w, "{", 1);
+    emit_members(&w, root_table, NULL, 1, 1); // Top-level tables are the root and its siblings
+    if (root_table) emit_newline(&w, 0);
+    emit(&w, "}", 1);
+    if (pretty) emit(&w, "\n", 1);
+    return w.failed ? -1 : 0;
+}
+
+// Writes NUL-terminated JSON into buffer. Returns -1 when it does not fit; length
+// then receives the size needed, not counting the terminator, like snprintf.
+int tomlinc_to_json_buffer(const TomlTable *root_table, int pretty, char *buffer, size_t size, size_t *length) {
+    if (!buffer && size > 0) return -1;
+    if (root_table && root_table->doc && root_table->doc->image) return -1;
+
+    BufferSink out = { buffer, size, 0 };
+    tomlinc_to_json(root_table, pretty, buffer_sink, &out);
+    if (length) *length = out.length;
+
+    if (out.length >= size) {
+        if (size > 0) buffer[size - 1] = '\0';
+        return -1;
+    }
+    buffer[out.length] = '\0';
+    return 0;
+}
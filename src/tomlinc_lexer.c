@@ -0,0 +1,449 @@
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+// Key/value lexer. Every byte is classified once through char_class and
+// consumed by a small state machine; strings and bare tokens are collected
+// into one reusable token buffer, and arrays are built while they are read,
+// pulling continuation lines from the file only when a bracket is still open.
+
+#define LEXER_MAX_DEPTH 64
+
+typedef enum {
+    CH_OTHER = 0,
+    CH_SPACE,
+    CH_NEWLINE,
+    CH_END,
+    CH_BASIC_QUOTE,
+    CH_LITERAL_QUOTE,
+    CH_BACKSLASH,
+    CH_OPEN,
+    CH_CLOSE,
+    CH_COMMA,
+    CH_COMMENT,
+    CH_EQUALS
+} CharClass;
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CH_END,
+    [' '] = CH_SPACE,
+    ['\t'] = CH_SPACE,
+    ['\r'] = CH_SPACE,
+    ['\n'] = CH_NEWLINE,
+    ['"'] = CH_BASIC_QUOTE,
+    ['\''] = CH_LITERAL_QUOTE,
+    ['\\'] = CH_BACKSLASH,
+    ['['] = CH_OPEN,
+    [']'] = CH_CLOSE,
+    [','] = CH_COMMA,
+    ['#'] = CH_COMMENT,
+    ['='] = CH_EQUALS,
+};
+
+#define CLASS(c) ((CharClass)char_class[(unsigned char)(c)])
+
+typedef enum {
+    TOK_STRING,
+    TOK_BARE,
+    TOK_OPEN,
+    TOK_CLOSE,
+    TOK_COMMA,
+    TOK_EQUALS,
+    TOK_END,
+    TOK_ERROR
+} TokenKind;
+
+typedef struct {
+    const char *pos;      // Next unread byte
+    FILE *file;           // Continuation lines for open arrays, may be NULL
+    int continued;        // pos points into line, read from file
+    int partial;          // line stops short of the end of its line in the file
+    size_t depth;         // Open brackets
+    char line[256];
+
+    char *token;          // Text of the last string or bare token, NUL-terminated
+    size_t token_length;
+    size_t token_capacity;
+    int failed;           // Out of memory while collecting a token
+} Lexer;
+
+static int refill(Lexer *lx) {
+    if (!lx->file || !fgets(lx->line, sizeof(lx->line), lx->file)) return 0;
+    size_t length = strlen(lx->line);
+    lx->pos = lx->line;
+    lx->continued = 1;
+    lx->partial = length > 0 && lx->line[length - 1] != '\n';
+    return 1;
+}
+
+// A line longer than the buffer goes on in the next read. Reading on to its
+// end keeps the tail of a long comment or string from passing for new tokens.
+static int line_goes_on(const Lexer *lx) {
+    return lx->continued && lx->partial;
+}
+
+// pos is on a '#'; the comment may go on past the end of the buffer
+static void skip_comment(Lexer *lx) {
+    do {
+        while (CLASS(*lx->pos) != CH_NEWLINE && CLASS(*lx->pos) != CH_END) lx->pos++;
+    } while (CLASS(*lx->pos) == CH_END && line_goes_on(lx) && refill(lx));
+}
+
+static void token_append(Lexer *lx, const char *data, size_t len) {
+    if (lx->failed) return;
+    if (lx->token_length + len + 1 > lx->token_capacity) {
+        size_t new_capacity = lx->token_capacity ? lx->token_capacity * 2 : 64;
+        while (new_capacity < lx->token_length + len + 1) new_capacity *= 2;
+        char *new_token = mem_realloc(lx->token, new_capacity);
+        if (!new_token) {
+            lx->failed = 1;
+            return;
+        }
+        lx->token = new_token;
+        lx->token_capacity = new_capacity;
+    }
+    memcpy(lx->token + lx->token_length, data, len);
+    lx->token_length += len;
+    lx->token[lx->token_length] = '\0';
+}
+
+// Quoted string, pos is on the opening quote. The text is kept as written:
+// escapes only protect the character after the backslash, since
+// write_table_to_file writes strings back without escaping them.
+static TokenKind lex_string(Lexer *lx) {
+    CharClass quote = CLASS(*lx->pos);
+    int escaped = 0;
+
+    lx->pos++;
+    lx->token_length = 0;
+    token_append(lx, "", 0);
+
+    for (;;) {
+        const char *run = lx->pos;
+        CharClass c;
+        while ((c = CLASS(*lx->pos)) != quote && c != CH_BACKSLASH && c != CH_NEWLINE && c != CH_END) {
+            lx->pos++;
+            escaped = 0;
+        }
+        token_append(lx, run, (size_t)(lx->pos - run));
+
+        switch (c) {
+            case CH_BACKSLASH:
+                token_append(lx, lx->pos++, 1);
+                escaped = quote == CH_BASIC_QUOTE && !escaped;
+                break;
+            case CH_END:
+                if (line_goes_on(lx) && refill(lx)) break;
+                return TOK_ERROR;
+            case CH_NEWLINE:
+                return TOK_ERROR; // Multi-line strings are not supported
+            default:
+                if (escaped) {
+                    token_append(lx, lx->pos++, 1);
+                    escaped = 0;
+                    break;
+                }
+                lx->pos++; // Closing quote
+                return lx->failed ? TOK_ERROR : TOK_STRING;
+        }
+    }
+}
+
+// Unquoted token: numbers, booleans and keys
+static TokenKind lex_bare(Lexer *lx) {
+    lx->token_length = 0;
+    token_append(lx, "", 0);
+
+    for (;;) {
+        const char *run = lx->pos;
+        CharClass c;
+        while ((c = CLASS(*lx->pos)) == CH_OTHER || c == CH_BACKSLASH) lx->pos++;
+        token_append(lx, run, (size_t)(lx->pos - run));
+
+        if (c != CH_END || !line_goes_on(lx) || !refill(lx)) break;
+    }
+    return lx->failed ? TOK_ERROR : TOK_BARE;
+}
+
+static TokenKind next_token(Lexer *lx) {
+    for (;;) {
+        switch (CLASS(*lx->pos)) {
+            case CH_SPACE:
+            case CH_NEWLINE:
+                lx->pos++;
+                break;
+            case CH_COMMENT:
+                skip_comment(lx);
+                break;
+            case CH_END:
+                // An open array continues on the following lines, a long line in the next read
+                if ((lx->depth > 0 || line_goes_on(lx)) && refill(lx)) break;
+                return TOK_END;
+            case CH_OPEN:
+                lx->pos++;
+                lx->depth++;
+                return TOK_OPEN;
+            case CH_CLOSE:
+                lx->pos++;
+                if (lx->depth > 0) lx->depth--;
+                return TOK_CLOSE;
+            case CH_COMMA:
+                lx->pos++;
+                return TOK_COMMA;
+            case CH_EQUALS:
+                lx->pos++;
+                return TOK_EQUALS;
+            case CH_BASIC_QUOTE:
+            case CH_LITERAL_QUOTE:
+                return lex_string(lx);
+            default:
+                return lex_bare(lx);
+        }
+    }
+}
+
+// Number, boolean, inf or nan
+static int bare_value(const char *text, size_t length, void **value, TomlValueType *type, size_t *precision) {
+    *precision = 0;
+
+    if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0) {
+        int *bvalue = mem_malloc(sizeof(int));
+        if (!bvalue) return -1;
+        *bvalue = text[0] == 't';
+        *value = bvalue;
+        *type = TOML_VALUE_BOOL;
+        return 0;
+    }
+
+    const char *digits = text + (text[0] == '+' || text[0] == '-');
+    if (strcmp(digits, "inf") == 0 || strcmp(digits, "nan") == 0) {
+        float *fvalue = mem_malloc(sizeof(float));
+        if (!fvalue) return -1;
+        *fvalue = digits[0] == 'i' ? (text[0] == '-' ? -INFINITY : INFINITY) : NAN;
+        *value = fvalue;
+        *type = TOML_VALUE_FLOAT;
+        return 0;
+    }
+    if (*digits < '0' || *digits > '9') return -1;
+
+    // Copy without digit separators
+    char number[64];
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '_') continue;
+        if (n + 1 >= sizeof(number)) return -1;
+        number[n++] = text[i];
+    }
+    number[n] = '\0';
+
+    int base = 10;
+    const char *start = number;
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'o' || digits[1] == 'b')) {
+        base = digits[1] == 'x' ? 16 : digits[1] == 'o' ? 8 : 2;
+        start = number + (digits - text) + 2;
+        if (digits != text) return -1; // No sign on prefixed integers
+    }
+
+    char *end;
+    errno = 0;
+    if (base == 10 && strpbrk(number, ".eE")) {
+        float *fvalue = mem_malloc(sizeof(float));
+        if (!fvalue) return -1;
+        *fvalue = strtof(number, &end);
+        if (*end != '\0') {
+            mem_free(fvalue);
+            return -1;
+        }
+
+        const char *dot = strchr(number, '.');
+        if (dot) {
+            while (dot[1 + *precision] >= '0' && dot[1 + *precision] <= '9') (*precision)++;
+        }
+        *value = fvalue;
+        *type = TOML_VALUE_FLOAT;
+        return 0;
+    }
+
+    long lvalue = strtol(start, &end, base);
+    if (*end != '\0' || end == start || errno == ERANGE || lvalue < INT_MIN || lvalue > INT_MAX) return -1;
+
+    int *ivalue = mem_malloc(sizeof(int));
+    if (!ivalue) return -1;
+    *ivalue = (int)lvalue;
+    *value = ivalue;
+    *type = TOML_VALUE_INT;
+    return 0;
+}
+
+static int token_value(Lexer *lx, TokenKind kind, void **value, TomlValueType *type, size_t *precision) {
+    if (kind == TOK_STRING) {
+        *value = mem_strdup(lx->token);
+        *type = TOML_VALUE_STRING;
+        *precision = 0;
+        return *value ? 0 : -1;
+    }
+    if (kind == TOK_BARE) return bare_value(lx->token, lx->token_length, value, type, precision);
+    return -1;
+}
+
+static int array_push(TomlArray *array, size_t *capacity, void *value, TomlValueType type, size_t precision) {
+    if (array->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 4;
+        if (array_reserve(array, new_capacity) != 0) return -1;
+        *capacity = new_capacity;
+    }
+    array->values[array->count] = value;
+    array->types[array->count] = type;
+    array->float_precisions[array->count] = precision;
+    array->count++;
+    return 0;
+}
+
+// Elements up to the matching ']', the '[' has been read
+static TomlArray *parse_array(Lexer *lx, size_t depth) {
+    TomlArray *array = mem_calloc(1, sizeof(TomlArray));
+    size_t capacity = 0;
+    if (!array) return NULL;
+
+    for (;;) {
+        TokenKind kind = next_token(lx);
+        if (kind == TOK_CLOSE) return array; // Empty array or trailing comma
+
+        void *value;
+        TomlValueType type;
+        size_t precision = 0;
+        if (kind == TOK_OPEN) {
+            if (depth + 1 >= LEXER_MAX_DEPTH) break;
+            value = parse_array(lx, depth + 1);
+            type = TOML_VALUE_ARRAY;
+            if (!value) break;
+        } else if (token_value(lx, kind, &value, &type, &precision) != 0) {
+            break;
+        }
+
+        if (array_push(array, &capacity, value, type, precision) != 0) {
+            free_value(value, type);
+            break;
+        }
+
+        kind = next_token(lx);
+        if (kind == TOK_CLOSE) return array;
+        if (kind != TOK_COMMA) break;
+    }
+
+    free_array(array);
+    return NULL;
+}
+
+// Step over a key = value line the way parse_pair reads it, consuming the
+// continuation lines of an open array, but only tracking brackets and quotes:
+// nothing is collected or allocated.
+void skip_pair(const char *line, FILE *file) {
+    Lexer lx = { 0 };
+    lx.pos = line;
+    lx.file = file;
+
+    for (;;) {
+        CharClass c = CLASS(*lx.pos);
+        switch (c) {
+            case CH_END:
+                if ((lx.depth > 0 || line_goes_on(&lx)) && refill(&lx)) break;
+                return;
+            case CH_COMMENT:
+                skip_comment(&lx);
+                break;
+            case CH_OPEN:
+                lx.pos++;
+                lx.depth++;
+                break;
+            case CH_CLOSE:
+                lx.pos++;
+                if (lx.depth > 0) lx.depth--;
+                break;
+            case CH_BASIC_QUOTE:
+            case CH_LITERAL_QUOTE:
+                lx.pos++;
+                for (;;) {
+                    CharClass s = CLASS(*lx.pos);
+                    if (s == c) {
+                        lx.pos++;
+                        break;
+                    }
+                    if (s == CH_BACKSLASH && c == CH_BASIC_QUOTE && lx.pos[1] != '\0') {
+                        lx.pos += 2;
+                    } else if (s == CH_END) {
+                        if (line_goes_on(&lx) && refill(&lx)) continue;
+                        break;
+                    } else if (s == CH_NEWLINE) {
+                        break; // Unterminated, parse_pair gives up on the value here too
+                    } else {
+                        lx.pos++;
+                    }
+                }
+                break;
+            default:
+                lx.pos++;
+                break;
+        }
+    }
+}
+
+// Parse a key = value line. Arrays may continue on the following lines of
+// file, which are consumed up to the closing bracket even when the value is
+// malformed, so the caller resumes after it.
+TomlPair *parse_pair(const char *line, FILE *file) {
+    Lexer lx = { 0 };
+    lx.pos = line;
+    lx.file = file;
+
+    TomlPair *pair = NULL;
+    void *value = NULL;
+    TomlValueType type = TOML_VALUE_INT;
+    size_t precision;
+
+    TokenKind kind = next_token(&lx);
+    if (kind != TOK_STRING && kind != TOK_BARE) goto done;
+    char *key = mem_strdup(lx.token);
+    if (!key || next_token(&lx) != TOK_EQUALS) {
+        mem_free(key);
+        goto done;
+    }
+
+    kind = next_token(&lx);
+    if (kind == TOK_OPEN) {
+        value = parse_array(&lx, 0);
+        type = TOML_VALUE_ARRAY;
+    } else if (token_value(&lx, kind, &value, &type, &precision) != 0) {
+        value = NULL;
+    }
+
+    // Nothing but a comment may follow the value
+    if (!value || next_token(&lx) != TOK_END) {
+        mem_free(key);
+        goto done;
+    }
+
+    pair = mem_malloc(sizeof(TomlPair));
+    if (!pair) {
+        mem_free(key);
+        goto done;
+    }
+    pair->key = key;
+    pair->value = value;
+    pair->type = type;
+    pair->next = NULL;
+    pair->shares = 0;
+    value = NULL;
+
+done:
+    if (value) free_value(value, type);
+    while ((lx.depth > 0 || line_goes_on(&lx)) && next_token(&lx) != TOK_END) {
+        // Skip the rest of a malformed array or long line
+    }
+    mem_free(lx.token);
+    return pair;
+}
@@ -0,0 +1,546 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// MessagePack encoding of a document. The document is a map of its top-level
+// tables; a table is a map of its pairs followed by its subtables, and an
+// array of tables is an array of maps. TOML arrays cannot hold tables, so the
+// decoder can tell them apart from arrays of tables by their first element.
+// Tables below an array of tables belong to its container, as the parser puts
+// them there, and follow the array under their dotted path ("device.channel").
+
+#define MSGPACK_MAX_DEPTH 64
+
+typedef struct {
+    TomlSink sink;
+    void *userdata;
+    int failed;
+} PackWriter;
+
+static void put(PackWriter *w, const void *data, size_t len) {
+    if (w->failed || len == 0) return;
+    if (w->sink((const char *)data, len, w->userdata) != 0) w->failed = 1;
+}
+
+// Type byte followed by a big-endian value of size bytes
+static void put_header(PackWriter *w, unsigned char type, uint64_t value, size_t size) {
+    unsigned char bytes[9];
+    bytes[0] = type;
+    for (size_t i = 0; i < size; i++) {
+        bytes[1 + i] = (unsigned char)(value >> (8 * (size - 1 - i)));
+    }
+    put(w, bytes, 1 + size);
+}
+
+// Header for a str, array or map, using the fix form when the length fits
+static void put_length(PackWriter *w, unsigned char fix, size_t fix_max, unsigned char base, size_t len) {
+    if (len <= fix_max) {
+        put_header(w, (unsigned char)(fix | len), 0, 0);
+    } else if (base == 0xd9 && len <= 0xff) {
+        put_header(w, 0xd9, len, 1); // str8, strings only
+    } else if (len <= 0xffff) {
+        put_header(w, base == 0xd9 ? 0xda : base, len, 2);
+    } else {
+        put_header(w, base == 0xd9 ? 0xdb : base + 1, len, 4);
+    }
+}
+
+static void put_string(PackWriter *w, const char *str) {
+    size_t len = strlen(str);
+    put_length(w, 0xa0, 31, 0xd9, len);
+    put(w, str, len);
+}
+
+static void put_int(PackWriter *w, int value) {
+    if (value >= 0 && value <= 0x7f) {
+        put_header(w, (unsigned char)value, 0, 0);
+    } else if (value < 0 && value >= -32) {
+        put_header(w, (unsigned char)(value & 0xff), 0, 0);
+    } else if (value >= INT8_MIN && value <= INT8_MAX) {
+        put_header(w, 0xd0, (uint8_t)value, 1);
+    } else if (value >= INT16_MIN && value <= INT16_MAX) {
+        put_header(w, 0xd1, (uint16_t)value, 2);
+    } else {
+        put_header(w, 0xd2, (uint32_t)value, 4);
+    }
+}
+
+static void put_value(PackWriter *w, const void *value, TomlValueType type) {
+    switch (type) {
+        case TOML_VALUE_STRING:
+            put_string(w, (const char *)value);
+            break;
+        case TOML_VALUE_INT:
+            put_int(w, load_int(value));
+            break;
+        case TOML_VALUE_FLOAT: {
+            float floating = load_float(value);
+            uint32_t bits;
+            memcpy(&bits, &floating, sizeof(bits));
+            put_header(w, 0xca, bits, 4);
+            break;
+        }
+        case TOML_VALUE_BOOL:
+            put_header(w, load_int(value) ? 0xc3 : 0xc2, 0, 0);
+            break;
+        case TOML_VALUE_ARRAY: {
+            const TomlArray *array = (const TomlArray *)value;
+            put_length(w, 0x90, 15, 0xdc, array->count);
+            for (size_t i = 0; i < array->count; i++) {
+                put_value(w, array->values[i], array->types[i]);
+            }
+            break;
+        }
+    }
+}
+
+// A table name preceded by the names of the containers it hangs off
+typedef struct KeyPrefix {
+    const struct KeyPrefix *parent;
+    const char *name;
+} KeyPrefix;
+
+static size_t prefix_length(const KeyPrefix *prefix) {
+    return prefix ? prefix_length(prefix->parent) + strlen(prefix->name) + 1 : 0;
+}
+
+static void put_prefix(PackWriter *w, const KeyPrefix *prefix) {
+    if (!prefix) return;
+    put_prefix(w, prefix->parent);
+    put(w, prefix->name, strlen(prefix->name));
+    put(w, ".", 1);
+}
+
+static void put_key(PackWriter *w, const KeyPrefix *prefix, const char *name) {
+    size_t len = strlen(name);
+    put_length(w, 0xa0, 31, 0xd9, prefix_length(prefix) + len);
+    put_prefix(w, prefix);
+    put(w, name, len);
+}
+
+// Map entries taken by a list of sibling tables, including the ones below their containers
+static size_t table_entries(const TomlTable *list) {
+    size_t count = 0;
+    for (const TomlTable *table = list; table; table = table->next) {
+        count++;
+        if (table->is_array_container) count += table_entries(table->subtables);
+    }
+    return count;
+}
+
+static void put_tables(PackWriter *w, const TomlTable *list, const KeyPrefix *prefix);
+
+static void put_table(PackWriter *w, const TomlTable *table) {
+    size_t count = table_entries(table->subtables);
+    for (const TomlPair *pair = table->pairs; pair; pair = pair->next) count++;
+
+    put_length(w, 0x80, 15, 0xde, count);
+    for (const TomlPair *pair = table->pairs; pair; pair = pair->next) {
+        put_string(w, pair->key);
+        put_value(w, pair->value, pair->type);
+    }
+    put_tables(w, table->subtables, NULL);
+}
+
+// Entries for a list of sibling tables
+static void put_tables(PackWriter *w, const TomlTable *list, const KeyPrefix *prefix) {
+    for (const TomlTable *table = list; table && !w->failed; table = table->next) {
+        put_key(w, prefix, table->name);
+        if (!table->is_array_container) {
+            put_table(w, table);
+            continue;
+        }
+
+        size_t count = 0;
+        for (const TomlTable *element = table->array_of_tables; element; element = element->next) count++;
+        put_length(w, 0x90, 15, 0xdc, count);
+        for (const TomlTable *element = table->array_of_tables; element; element = element->next) {
+            put_table(w, element);
+        }
+
+        KeyPrefix container = { prefix, table->name };
+        put_tables(w, table->subtables, &container);
+    }
+}
+
+int tomlinc_to_msgpack(const TomlTable *root_table, TomlSink sink, void *userdata) {
+    if (!sink) return -1;
+    if (root_table && root_table->doc && root_table->doc->image) return -1; // No tree to walk
+
+    PackWriter w = { sink, userdata, 0 };
+    put_length(&w, 0x80, 15, 0xde, table_entries(root_table));
+    put_tables(&w, root_table, NULL);
+    return w.failed ? -1 : 0;
+}
+
+// Returns -1 when the encoding does not fit; length then receives the size needed
+int tomlinc_to_msgpack_buffer(const TomlTable *root_table, void *buffer, size_t size, size_t *length) {
+    if (!buffer && size > 0) return -1;
+    if (root_table && root_table->doc && root_table->doc->image) return -1;
+
+    BufferSink out = { (char *)buffer, size, 0 };
+    tomlinc_to_msgpack(root_table, buffer_sink, &out);
+    if (length) *length = out.length;
+    return out.length <= size ? 0 : -1;
+}
+
+typedef enum {
+    ITEM_BOOL,
+    ITEM_INT,
+    ITEM_FLOAT,
+    ITEM_STRING,
+    ITEM_ARRAY,
+    ITEM_MAP
+} ItemKind;
+
+typedef struct {
+    ItemKind kind;
+    int boolean;
+    int64_t integer;
+    double floating;
+    const char *string; // Not terminated, see length
+    size_t length;      // String length, or element count of an array or map
+} PackItem;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+} PackReader;
+
+static int read_be(PackReader *r, size_t size, uint64_t *value) {
+    if (r->size - r->pos < size) return -1;
+    *value = 0;
+    for (size_t i = 0; i < size; i++) {
+        *value = (*value << 8) | r->data[r->pos++];
+    }
+    return 0;
+}
+
+static int read_string_body(PackReader *r, size_t len, PackItem *item) {
+    if (r->size - r->pos < len) return -1;
+    item->kind = ITEM_STRING;
+    item->string = (const char *)r->data + r->pos;
+    item->length = len;
+    r->pos += len;
+    return 0;
+}
+
+// Read one item. Arrays and maps only have their header read.
+static int read_item(PackReader *r, PackItem *item) {
+    uint64_t value;
+    if (read_be(r, 1, &value) != 0) return -1;
+    unsigned char type = (unsigned char)value;
+
+    if (type <= 0x7f) {
+        item->kind = ITEM_INT;
+        item->integer = type;
+        return 0;
+    }
+    if (type >= 0xe0) {
+        item->kind = ITEM_INT;
+        item->integer = (int8_t)type;
+        return 0;
+    }
+    if ((type & 0xe0) == 0xa0) return read_string_body(r, type & 0x1f, item);
+    if ((type & 0xf0) == 0x90 || (type & 0xf0) == 0x80) {
+        item->kind = (type & 0xf0) == 0x90 ? ITEM_ARRAY : ITEM_MAP;
+        item->length = type & 0x0f;
+        return 0;
+    }
+
+    switch (type) {
+        case 0xc2:
+        case 0xc3:
+            item->kind = ITEM_BOOL;
+            item->boolean = type == 0xc3;
+            return 0;
+        case 0xca: {
+            if (read_be(r, 4, &value) != 0) return -1;
+            uint32_t bits = (uint32_t)value;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            item->kind = ITEM_FLOAT;
+            item->floating = f;
+            return 0;
+        }
+        case 0xcb: {
+            if (read_be(r, 8, &value) != 0) return -1;
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            item->kind = ITEM_FLOAT;
+            item->floating = d;
+            return 0;
+        }
+        case 0xcc: case 0xcd: case 0xce: case 0xcf: {
+            size_t size = (size_t)1 << (type - 0xcc);
+            if (read_be(r, size, &value) != 0 || value > INT64_MAX) return -1;
+            item->kind = ITEM_INT;
+            item->integer = (int64_t)value;
+            return 0;
+        }
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+            size_t size = (size_t)1 << (type - 0xd0);
+            if (read_be(r, size, &value) != 0) return -1;
+            // Sign-extend from the encoded width
+            if (size < 8 && (value >> (size * 8 - 1))) value |= ~(uint64_t)0 << (size * 8);
+            item->kind = ITEM_INT;
+            item->integer = (int64_t)value;
+            return 0;
+        }
+        case 0xd9: case 0xda: case 0xdb: {
+            size_t size = (size_t)1 << (type - 0xd9);
+            if (read_be(r, size, &value) != 0) return -1;
+            return read_string_body(r, (size_t)value, item);
+        }
+        case 0xdc: case 0xdd: case 0xde: case 0xdf: {
+            size_t size = (type == 0xdc || type == 0xde) ? 2 : 4;
+            if (read_be(r, size, &value) != 0) return -1;
+            item->kind = type <= 0xdd ? ITEM_ARRAY : ITEM_MAP;
+            item->length = (size_t)value;
+            return 0;
+        }
+    }
+    return -1; // nil, binary, extension types have no TOML equivalent
+}
+
+static char *item_string(const PackItem *item) {
+    if (memchr(item->string, '\0', item->length)) return NULL; // Cannot be held in a C string
+    return strndup(item->string, item->length);
+}
+
+static int decode_value(PackReader *r, const PackItem *item, void **value, TomlValueType *type, int depth);
+
+static TomlArray *decode_array(PackReader *r, size_t count, int depth) {
+    // Every element takes at least one byte, so a bogus count cannot force a huge allocation
+    if (count > r->size - r->pos) return NULL;
+
+    TomlArray *array = calloc(1, sizeof(TomlArray));
+    if (!array || array_reserve(array, count) != 0) {
+        free_array(array);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        PackItem item;
+        if (read_item(r, &item) != 0 || decode_value(r, &item, &array->values[i], &array->types[i], depth) != 0) {
+            free_array(array);
+            return NULL;
+        }
+        array->float_precisions[i] = array->types[i] == TOML_VALUE_FLOAT ? float_precision(*(float *)array->values[i]) : 0;
+        array->count++;
+    }
+    return array;
+}
+
+static int decode_value(PackReader *r, const PackItem *item, void **value, TomlValueType *type, int depth) {
+    switch (item->kind) {
+        case ITEM_STRING:
+            *type = TOML_VALUE_STRING;
+            *value = item_string(item);
+            break;
+        case ITEM_INT:
+        case ITEM_BOOL:
+            if (item->kind == ITEM_INT && (item->integer < INT_MIN || item->integer > INT_MAX)) return -1;
+            *type = item->kind == ITEM_INT ? TOML_VALUE_INT : TOML_VALUE_BOOL;
+            *value = malloc(sizeof(int));
+            if (*value) *(int *)*value = item->kind == ITEM_INT ? (int)item->integer : item->boolean;
+            break;
+        case ITEM_FLOAT:
+            *type = TOML_VALUE_FLOAT;
+            *value = malloc(sizeof(float));
+            if (*value) *(float *)*value = (float)item->floating;
+            break;
+        case ITEM_ARRAY:
+            if (depth >= MSGPACK_MAX_DEPTH) return -1;
+            *type = TOML_VALUE_ARRAY;
+            *value = decode_array(r, item->length, depth + 1);
+            break;
+        case ITEM_MAP:
+            return -1; // Tables are only allowed where decode_table expects them
+    }
+    return *value ? 0 : -1;
+}
+
+static TomlTable *new_table(const PackItem *name, TomlTable *parent) {
+    TomlTable *table = calloc(1, sizeof(TomlTable));
+    if (!table) return NULL;
+
+    table->name = item_string(name);
+    if (!table->name) {
+        free(table);
+        return NULL;
+    }
+    table->parent = parent;
+    table->path_hash = table_path_hash(parent, table->name);
+    return table;
+}
+
+// Create the table a dotted key such as "device.channel" stands for. Every name
+// before the last dot is an array of tables decoded earlier, starting from list,
+// and the table is appended to the subtables of the last one.
+static TomlTable *new_container_child(TomlTable *list, const PackItem *key) {
+    const char *segment = key->string;
+    const char *end = key->string + key->length;
+    TomlTable *container = NULL;
+
+    for (const char *dot; (dot = memchr(segment, '.', (size_t)(end - segment))) != NULL; segment = dot + 1) {
+        size_t len = (size_t)(dot - segment);
+        for (container = list; container; container = container->next) {
+            if (strncmp(container->name, segment, len) == 0 && container->name[len] == '\0') break;
+        }
+        if (!container || !container->is_array_container) return NULL;
+        list = container->subtables;
+    }
+    if (!container || segment == end) return NULL;
+
+    PackItem name = *key;
+    name.string = segment;
+    name.length = (size_t)(end - segment);
+    TomlTable *table = new_table(&name, container);
+    if (!table) return NULL;
+
+    TomlTable **link = &container->subtables;
+    while (*link) link = &(*link)->next;
+    *link = table;
+    return table;
+}
+
+static int decode_table(PackReader *r, TomlTable *table, size_t count, int depth);
+
+// An array of maps, the container has already been created
+static int decode_array_of_tables(PackReader *r, TomlTable *container, size_t count, int depth) {
+    for (size_t i = 0; i < count; i++) {
+        PackItem item;
+        if (read_item(r, &item) != 0 || item.kind != ITEM_MAP) return -1;
+
+        TomlTable *element = append_array_of_tables_element(container);
+        if (!element || decode_table(r, element, item.length, depth) != 0) return -1;
+    }
+    return 0;
+}
+
+// Map entries of a table. Everything built is linked into the table right
+// away, so freeing the tree also cleans up after a failure.
+static int decode_table(PackReader *r, TomlTable *table, size_t count, int depth) {
+    if (depth >= MSGPACK_MAX_DEPTH) return -1;
+
+    TomlPair *last_pair = NULL;
+    TomlTable *last_child = NULL;
+    for (size_t i = 0; i < count; i++) {
+        PackItem key, item;
+        if (read_item(r, &key) != 0 || key.kind != ITEM_STRING) return -1;
+
+        size_t value_pos = r->pos;
+        if (read_item(r, &item) != 0) return -1;
+
+        // Maps and arrays of maps are tables, everything else is a pair
+        int is_table = item.kind == ITEM_MAP;
+        int is_array_of_tables = 0;
+        if (item.kind == ITEM_ARRAY && item.length > 0) {
+            size_t element_pos = r->pos;
+            PackItem first;
+            if (read_item(r, &first) != 0) return -1;
+            is_array_of_tables = first.kind == ITEM_MAP;
+            r->pos = element_pos;
+        }
+
+        if (is_table || is_array_of_tables) {
+            TomlTable *child;
+            if (memchr(key.string, '.', key.length)) {
+                child = new_container_child(table->subtables, &key);
+                if (!child) return -1;
+            } else {
+                child = new_table(&key, table);
+                if (!child) return -1;
+                if (last_child) {
+                    last_child->next = child;
+                } else {
+                    table->subtables = child;
+                }
+                last_child = child;
+            }
+
+            int result = is_table ? decode_table(r, child, item.length, depth + 1)
+                                  : decode_array_of_tables(r, child, item.length, depth + 1);
+            if (result != 0) return -1;
+            continue;
+        }
+
+        TomlPair *pair = calloc(1, sizeof(TomlPair));
+        if (!pair) return -1;
+        pair->key = item_string(&key);
+        if (!pair->key) {
+            free(pair);
+            return -1;
+        }
+        r->pos = value_pos;
+        if (read_item(r, &item) != 0 || decode_value(r, &item, &pair->value, &pair->type, depth) != 0) {
+            free(pair->key);
+            free(pair);
+            return -1;
+        }
+
+        if (last_pair) {
+            last_pair->next = pair;
+        } else {
+            table->pairs = pair;
+        }
+        last_pair = pair;
+    }
+    return 0;
+}
+
+// Rebuild a document from tomlinc_to_msgpack output. The result is used and
+// closed like one returned by tomlinc_open_file.
+TomlTable *tomlinc_from_msgpack(const void *data, size_t size) {
+    if (!data) return NULL;
+
+    PackReader r = { (const unsigned char *)data, size, 0 };
+    PackItem item;
+    if (read_item(&r, &item) != 0 || item.kind != ITEM_MAP) return NULL;
+
+    TomlTable *root = NULL;
+    TomlTable *last = NULL;
+    for (size_t i = 0; i < item.length; i++) {
+        PackItem name, value;
+        if (read_item(&r, &name) != 0 || name.kind != ITEM_STRING) goto fail;
+
+        TomlTable *table;
+        if (memchr(name.string, '.', name.length)) {
+            table = new_container_child(root, &name);
+            if (!table) goto fail;
+        } else {
+            table = new_table(&name, NULL);
+            if (!table) goto fail;
+            if (last) {
+                last->next = table;
+            } else {
+                root = table;
+            }
+            last = table;
+        }
+
+        if (read_item(&r, &value) != 0) goto fail;
+        if (value.kind == ITEM_MAP) {
+            if (decode_table(&r, table, value.length, 1) != 0) goto fail;
+        } else if (value.kind == ITEM_ARRAY) {
+            if (decode_array_of_tables(&r, table, value.length, 1) != 0 || !table->array_of_tables) goto fail;
+        } else {
+            goto fail; // Pairs outside of a table are not supported
+        }
+    }
+    if (!root || r.pos != r.size) goto fail;
+
+    rehash_tables(root);
+    root->doc = calloc(1, sizeof(TomlDocument));
+    if (!root->doc) goto fail;
+    return root;
+
+fail:
+    free_tables(root);
+    return NULL;
+}
@@ -0,0 +1,182 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Layered lookups over several documents without merging them. Resolved
+// (table_path, key) lookups are cached, including misses, and the cache is
+// dropped as soon as any layer's generation counter moves. Getters fill the
+// cache, so a mutex lets several threads read one overlay handle.
+
+typedef struct {
+    uint64_t hash;
+    char *table_path;       // NULL marks an empty slot
+    char *key;
+    const void *value;      // NULL caches a miss in every layer
+    TomlValueType type;
+} OverlayEntry;
+
+struct TomlOverlay {
+    pthread_mutex_t lock;     // Guards the generations and the cache
+    const TomlTable **layers; // Lowest priority first
+    uint64_t *generations;    // Layer generations the cache was filled at
+    size_t layer_count;
+
+    OverlayEntry *entries;
+    size_t capacity;          // Power of two, or 0 before the first lookup
+    size_t count;
+};
+
+static uint64_t layer_generation(const TomlTable *layer) {
+    return layer->doc ? layer->doc->generation : 0; // Embedded trees never change
+}
+
+static void clear_cache(TomlOverlay *overlay) {
+    for (size_t i = 0; i < overlay->capacity; i++) {
+        free(overlay->entries[i].table_path);
+        free(overlay->entries[i].key);
+    }
+    free(overlay->entries);
+    overlay->entries = NULL;
+    overlay->capacity = 0;
+    overlay->count = 0;
+}
+
+static OverlayEntry *find_slot(OverlayEntry *entries, size_t capacity, uint64_t hash, const char *table_path, const char *key) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        OverlayEntry *entry = &entries[i];
+        if (!entry->table_path) return entry;
+        if (entry->hash == hash && strcmp(entry->table_path, table_path) == 0 && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+}
+
+static int grow_cache(TomlOverlay *overlay) {
+    size_t new_capacity = overlay->capacity ? overlay->capacity * 2 : 64;
+    OverlayEntry *new_entries = calloc(new_capacity, sizeof(OverlayEntry));
+    if (!new_entries) return -1;
+
+    for (size_t i = 0; i < overlay->capacity; i++) {
+        OverlayEntry *entry = &overlay->entries[i];
+        if (entry->table_path) {
+            *find_slot(new_entries, new_capacity, entry->hash, entry->table_path, entry->key) = *entry;
+        }
+    }
+
+    free(overlay->entries);
+    overlay->entries = new_entries;
+    overlay->capacity = new_capacity;
+    return 0;
+}
+
+static const void *resolve_in_layers(const TomlOverlay *overlay, const char *table_path, const char *key, TomlValueType *type) {
+    for (size_t i = overlay->layer_count; i-- > 0;) {
+        const void *value = lookup_value(overlay->layers[i], table_path, key, type);
+        if (value) return value;
+    }
+    return NULL;
+}
+
+static const void *find_value_locked(TomlOverlay *overlay, const char *table_path, const char *key, TomlValueType *type) {
+    int stale = 0;
+    for (size_t i = 0; i < overlay->layer_count; i++) {
+        uint64_t generation = layer_generation(overlay->layers[i]);
+        if (overlay->generations[i] != generation) {
+            overlay->generations[i] = generation;
+            stale = 1;
+        }
+    }
+    if (stale) clear_cache(overlay);
+
+    uint64_t hash = hash_string(hash_string(0, table_path), key);
+    if (overlay->capacity) {
+        OverlayEntry *entry = find_slot(overlay->entries, overlay->capacity, hash, table_path, key);
+        if (entry->table_path) {
+            *type = entry->type;
+            return entry->value;
+        }
+    }
+
+    const void *value = resolve_in_layers(overlay, table_path, key, type);
+
+    // Keep the load factor at or below one half; a failed insert only costs caching
+    if ((overlay->count + 1) * 2 > overlay->capacity && grow_cache(overlay) != 0) return value;
+
+    char *path_copy = strdup(table_path);
+    char *key_copy = strdup(key);
+    if (!path_copy || !key_copy) {
+        free(path_copy);
+        free(key_copy);
+        return value;
+    }
+
+    OverlayEntry *entry = find_slot(overlay->entries, overlay->capacity, hash, table_path, key);
+    entry->hash = hash;
+    entry->table_path = path_copy;
+    entry->key = key_copy;
+    entry->value = value;
+    entry->type = value ? *type : TOML_VALUE_INT;
+    overlay->count++;
+    return value;
+}
+
+const void *overlay_find_value(TomlOverlay *overlay, const char *table_path, const char *key, TomlValueType *type) {
+    pthread_mutex_lock(&overlay->lock);
+    const void *value = find_value_locked(overlay, table_path, key, type);
+    pthread_mutex_unlock(&overlay->lock);
+    return value;
+}
+
+void overlay_free(TomlOverlay *overlay) {
+    if (!overlay) return;
+    clear_cache(overlay);
+    pthread_mutex_destroy(&overlay->lock);
+    free(overlay->layers);
+    free(overlay->generations);
+    free(overlay);
+}
+
+TomlTable *tomlinc_overlay_create(const TomlTable *const *layers, size_t count) {
+    if (!layers || count == 0) return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!layers[i]) return NULL;
+        if (layers[i]->doc && layers[i]->doc->overlay) return NULL; // Overlays do not nest
+    }
+
+    TomlOverlay *overlay = calloc(1, sizeof(TomlOverlay));
+    TomlTable *handle = calloc(1, sizeof(TomlTable));
+    if (!overlay || !handle) goto fail;
+    pthread_mutex_init(&overlay->lock, NULL);
+
+    overlay->layers = malloc(sizeof(*overlay->layers) * count);
+    overlay->generations = malloc(sizeof(*overlay->generations) * count);
+    if (!overlay->layers || !overlay->generations) goto fail;
+
+    overlay->layer_count = count;
+    for (size_t i = 0; i < count; i++) {
+        overlay->layers[i] = layers[i];
+        overlay->generations[i] = layer_generation(layers[i]);
+    }
+
+    // The handle is an empty table, so the table-level API sees nothing in it
+    handle->name = strdup("");
+    handle->doc = calloc(1, sizeof(TomlDocument));
+    if (!handle->name || !handle->doc) goto fail;
+
+    handle->doc->overlay = overlay;
+    return handle;
+
+fail:
+    overlay_free(overlay);
+    if (handle) {
+        free(handle->name);
+        free(handle->doc);
+        free(handle);
+    }
+    return NULL;
+}
@@ -0,0 +1,229 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Documents in caller-provided memory. With TOMLINC_STATIC_POOL the parser
+// and the setters allocate through mem_malloc and friends, which take their
+// memory from the pool that is active on the calling thread and fall back to
+// the C library otherwise. tomlinc_open_file_static makes the pool active
+// while it parses, setters of a pool document while they replace values.
+//
+// A pool is a bump allocator. Every block starts with its size, so freed
+// blocks up to POOL_MAX_CLASS bytes go to a free list per size and are
+// handed out again; larger ones are only reclaimed when the document is
+// closed, which releases the whole pool at once.
+
+#ifdef TOMLINC_STATIC_POOL
+
+#ifndef TOMLINC_POOL_LINE_MAX
+#define TOMLINC_POOL_LINE_MAX 1024 // Longest line tomlinc_open_file_static reads
+#endif
+
+#define POOL_ALIGN 8
+#define POOL_MAX_CLASS 256
+#define POOL_CLASSES (POOL_MAX_CLASS / POOL_ALIGN)
+
+typedef struct {
+    size_t size; // Usable bytes after the header
+} PoolBlock;
+
+struct TomlPool {
+    size_t header;        // Bytes of the caller's memory before base
+    unsigned char *base;  // First block
+    size_t size;
+    size_t top;           // Bump offset from base
+    size_t freed;         // Bytes of the blocks in the free lists
+    int exhausted;        // An allocation did not fit
+    PoolBlock *free_lists[POOL_CLASSES];
+};
+
+static _Thread_local TomlPool *active_pool;
+
+static size_t align_up(size_t size) {
+    return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+static PoolBlock *block_of(void *ptr) {
+    return (PoolBlock *)ptr - 1;
+}
+
+static int pool_owns(const TomlPool *pool, const void *ptr) {
+    const unsigned char *p = (const unsigned char *)ptr;
+    return p >= pool->base && p < pool->base + pool->top;
+}
+
+static void *pool_alloc(TomlPool *pool, size_t size) {
+    size = align_up(size ? size : 1);
+
+    if (size <= POOL_MAX_CLASS) {
+        PoolBlock **list = &pool->free_lists[size / POOL_ALIGN - 1];
+        if (*list) {
+            PoolBlock *block = *list;
+            *list = *(PoolBlock **)(block + 1);
+            pool->freed -= sizeof(PoolBlock) + size;
+            return block + 1;
+        }
+    }
+
+    size_t needed = sizeof(PoolBlock) + size;
+    if (needed > pool->size - pool->top) {
+        pool->exhausted = 1;
+        return NULL;
+    }
+    PoolBlock *block = (PoolBlock *)(pool->base + pool->top);
+    block->size = size;
+    pool->top += needed;
+    return block + 1;
+}
+
+static void pool_release_block(TomlPool *pool, void *ptr) {
+    PoolBlock *block = block_of(ptr);
+
+    // The last block simply gives its space back
+    if ((unsigned char *)(block + 1) + block->size == pool->base + pool->top) {
+        pool->top -= sizeof(PoolBlock) + block->size;
+        return;
+    }
+    if (block->size <= POOL_MAX_CLASS) {
+        PoolBlock **list = &pool->free_lists[block->size / POOL_ALIGN - 1];
+        *(PoolBlock **)(block + 1) = *list;
+        *list = block;
+        pool->freed += sizeof(PoolBlock) + block->size;
+    }
+}
+
+void *mem_malloc(size_t size) {
+    return active_pool ? pool_alloc(active_pool, size) : malloc(size);
+}
+
+void *mem_calloc(size_t count, size_t size) {
+    if (!active_pool) return calloc(count, size);
+    if (size && count > SIZE_MAX / size) return NULL;
+
+    void *ptr = pool_alloc(active_pool, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+    TomlPool *pool = active_pool;
+    if (!pool || (ptr && !pool_owns(pool, ptr))) return realloc(ptr, size);
+    if (!ptr) return pool_alloc(pool, size);
+
+    PoolBlock *block = block_of(ptr);
+    size_t old_size = block->size;
+    size = align_up(size ? size : 1);
+    if (size <= old_size) return ptr;
+
+    // Arrays grow one element at a time, the last block grows where it is
+    if ((unsigned char *)ptr + old_size == pool->base + pool->top) {
+        if (size - old_size > pool->size - pool->top) {
+            pool->exhausted = 1;
+            return NULL;
+        }
+        pool->top += size - old_size;
+        block->size = size;
+        return ptr;
+    }
+
+    // Blocks that have to move get room to grow, so an array that gains one
+    // element per call moves a logarithmic number of times
+    int exhausted = pool->exhausted;
+    void *new_ptr = pool_alloc(pool, size + size / 2);
+    if (!new_ptr) {
+        pool->exhausted = exhausted; // The exact size may still fit
+        new_ptr = pool_alloc(pool, size);
+        if (!new_ptr) return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size);
+    pool_release_block(pool, ptr);
+    return new_ptr;
+}
+
+char *mem_strdup(const char *str) {
+    if (!active_pool) return strdup(str);
+
+    size_t len = strlen(str) + 1;
+    char *copy = pool_alloc(active_pool, len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+void mem_free(void *ptr) {
+    if (!ptr) return;
+    if (active_pool && pool_owns(active_pool, ptr)) {
+        pool_release_block(active_pool, ptr);
+        return;
+    }
+    free(ptr);
+}
+
+TomlPool *pool_enter(const TomlTable *root) {
+    TomlPool *previous = active_pool;
+    if (root->doc && root->doc->pool) active_pool = root->doc->pool;
+    return previous;
+}
+
+void pool_leave(TomlPool *previous) {
+    active_pool = previous;
+}
+
+// Lay out the pool bookkeeping at the start of the caller's memory
+static TomlPool *pool_create(void *memory, size_t size) {
+    uintptr_t start = ((uintptr_t)memory + POOL_ALIGN - 1) & ~(uintptr_t)(POOL_ALIGN - 1);
+    size_t header = (size_t)(start - (uintptr_t)memory) + align_up(sizeof(TomlPool));
+    if (size <= header) return NULL;
+
+    TomlPool *pool = (TomlPool *)start;
+    memset(pool, 0, sizeof(TomlPool));
+    pool->header = header;
+    pool->base = (unsigned char *)memory + header;
+    pool->size = size - header;
+    return pool;
+}
+
+// Parse filename into pool. Lines are read into the far end of the pool,
+// which the document may use once parsing is done, so the longest line has to
+// fit in TOMLINC_POOL_LINE_MAX bytes.
+TomlTable *tomlinc_open_file_static(const char *filename, void *pool, size_t pool_size) {
+    if (!filename || !pool) return NULL;
+
+    TomlPool *target = pool_create(pool, pool_size);
+    if (!target || target->size < TOMLINC_POOL_LINE_MAX) return NULL;
+
+    target->size -= TOMLINC_POOL_LINE_MAX;
+    TomlPool *previous = active_pool;
+    active_pool = target;
+    TomlTable *root = parse_file(filename, (char *)target->base + target->size, TOMLINC_POOL_LINE_MAX, NULL, 0);
+    active_pool = previous;
+    target->size += TOMLINC_POOL_LINE_MAX;
+
+    // Half a document is worse than none, and nothing needs freeing
+    if (!root || target->exhausted) return NULL;
+    root->doc->pool = target;
+    return root;
+}
+
+size_t tomlinc_pool_used(const TomlTable *root_table) {
+    if (!root_table || !root_table->doc || !root_table->doc->pool) return 0;
+
+    const TomlPool *pool = root_table->doc->pool;
+    return pool->header + pool->top - pool->freed;
+}
+
+#else
+
+TomlTable *tomlinc_open_file_static(const char *filename, void *pool, size_t pool_size) {
+    (void)filename;
+    (void)pool;
+    (void)pool_size;
+    return NULL; // Built without TOMLINC_STATIC_POOL
+}
+
+size_t tomlinc_pool_used(const TomlTable *root_table) {
+    (void)root_table;
+    return 0;
+}
+
+#endif
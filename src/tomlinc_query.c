@@ -0,0 +1,188 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+// Compiled path queries such as "servers.*.port" or "device[*].dev_eui".
+// Every segment but the last selects tables, the last one selects keys. A
+// table segment may be followed by [*] or [N] to select array-of-tables
+// elements. Compiling parses the pattern once; running it is a plain walk of
+// the tree that compares names against the precomputed steps.
+
+typedef enum {
+    INDEX_NONE, // Select the table itself
+    INDEX_ALL,  // [*], every array-of-tables element
+    INDEX_ONE   // [N], a single element
+} QueryIndex;
+
+typedef struct {
+    const char *name; // NULL for the * wildcard
+    size_t len;
+    QueryIndex index;
+    size_t position;  // Element number for INDEX_ONE
+} QueryStep;
+
+struct TomlQueryPlan {
+    QueryStep *steps; // Table steps followed by the key step
+    size_t count;
+    char *names;      // Backing storage for the step names
+};
+
+typedef struct {
+    const TomlQueryPlan *plan;
+    TomlMatchCallback callback;
+    void *userdata;
+    int matches;
+    int stopped;
+} QueryRun;
+
+static int name_matches(const QueryStep *step, const char *name) {
+    if (!step->name) return 1;
+    return strncmp(name, step->name, step->len) == 0 && name[step->len] == '\0';
+}
+
+// Parse "[*]" or "[N]" after a segment name, returns the number of characters consumed or -1
+static int parse_index(const char *text, QueryStep *step) {
+    if (*text != '[') {
+        step->index = INDEX_NONE;
+        return 0;
+    }
+
+    if (text[1] == '*' && text[2] == ']') {
+        step->index = INDEX_ALL;
+        return 3;
+    }
+
+    const char *c = text + 1;
+    size_t position = 0;
+    if (!isdigit((unsigned char)*c)) return -1;
+    while (isdigit((unsigned char)*c)) {
+        if (position > (SIZE_MAX - 9) / 10) return -1; // Too large to be an index
+        position = position * 10 + (size_t)(*c - '0');
+        c++;
+    }
+    if (*c != ']') return -1;
+
+    step->index = INDEX_ONE;
+    step->position = position;
+    return (int)(c + 1 - text);
+}
+
+TomlQueryPlan *tomlinc_query_compile(const char *pattern) {
+    if (!pattern || !*pattern) return NULL;
+
+    TomlQueryPlan *plan = calloc(1, sizeof(TomlQueryPlan));
+    if (!plan) return NULL;
+
+    size_t segments = 1;
+    for (const char *c = pattern; *c; c++) {
+        if (*c == '.') segments++;
+    }
+
+    plan->names = strdup(pattern);
+    plan->steps = calloc(segments, sizeof(QueryStep));
+    if (!plan->names || !plan->steps) goto invalid;
+
+    const char *cursor = plan->names;
+    for (size_t i = 0; i < segments; i++) {
+        QueryStep *step = &plan->steps[i];
+        size_t len = strcspn(cursor, ".[");
+        if (len == 0) goto invalid; // Empty segment
+
+        if (len == 1 && *cursor == '*') {
+            step->name = NULL;
+        } else {
+            step->name = cursor;
+            step->len = len;
+            if (memchr(cursor, '*', len)) goto invalid; // Wildcards match whole names only
+        }
+        cursor += len;
+
+        int consumed = parse_index(cursor, step);
+        if (consumed < 0) goto invalid;
+        cursor += consumed;
+
+        if (i + 1 < segments) {
+            if (*cursor != '.') goto invalid;
+            cursor++;
+        } else if (*cursor != '\0') {
+            goto invalid;
+        }
+    }
+
+    // At least one table segment, and the last segment is a key
+    if (segments < 2 || plan->steps[segments - 1].index != INDEX_NONE) goto invalid;
+    plan->count = segments;
+    return plan;
+
+invalid:
+    tomlinc_query_free(plan);
+    return NULL;
+}
+
+void tomlinc_query_free(TomlQueryPlan *plan) {
+    if (!plan) return;
+    free(plan->steps);
+    free(plan->names);
+    free(plan);
+}
+
+static void match_pairs(QueryRun *run, const TomlTable *table, const QueryStep *step) {
+    for (const TomlPair *pair = table->pairs; pair && !run->stopped; pair = pair->next) {
+        if (!name_matches(step, pair->key)) continue;
+
+        TomlPairEntry entry;
+        fill_pair_entry(&entry, pair);
+        run->matches++;
+        if (run->callback(table, &entry, run->userdata) != 0) run->stopped = 1;
+    }
+}
+
+static void match_tables(QueryRun *run, const TomlTable *list, size_t depth);
+
+// Apply the remaining steps, starting at depth, below a matched table
+static void match_table(QueryRun *run, const TomlTable *table, size_t depth) {
+    if (depth + 1 == run->plan->count) {
+        match_pairs(run, table, &run->plan->steps[depth]);
+    } else {
+        match_tables(run, table->subtables, depth);
+    }
+}
+
+// Match the table step at depth against a sibling list, then continue below each hit
+static void match_tables(QueryRun *run, const TomlTable *list, size_t depth) {
+    const QueryStep *step = &run->plan->steps[depth];
+
+    for (const TomlTable *table = list; table && !run->stopped; table = table->next) {
+        if (!name_matches(step, table->name)) continue;
+
+        if (step->index == INDEX_NONE) {
+            match_table(run, table, depth + 1);
+            continue;
+        }
+
+        if (step->index == INDEX_ONE) {
+            const TomlTable *element = aot_element(table, step->position);
+            if (element) match_table(run, element, depth + 1);
+            continue;
+        }
+
+        for (const TomlTable *element = table->array_of_tables; element && !run->stopped; element = element->next) {
+            match_table(run, element, depth + 1);
+        }
+    }
+}
+
+// Returns the number of matches passed to the callback, or -1 on invalid arguments.
+// A non-zero return from the callback stops the walk.
+int tomlinc_query_run(const TomlQueryPlan *plan, const TomlTable *root_table, TomlMatchCallback callback, void *userdata) {
+    if (!plan || !callback) return -1;
+    if (root_table && root_table->doc && root_table->doc->image) return -1; // No tree to walk
+
+    QueryRun run = { plan, callback, userdata, 0, 0 };
+    match_tables(&run, root_table, 0); // Top-level tables are the root and its siblings
+    return run.matches;
+}
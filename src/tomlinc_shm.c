@@ -0,0 +1,223 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Publishing documents to other processes through POSIX shared memory. Every
+// version is a flat image (tomlinc_image.c) in its own read-only segment
+// "<name>.<generation>". A small control segment "<name>" holds the current
+// generation; the publisher writes the new segment completely before it
+// stores the generation, so readers only ever map finished images and never
+// take a lock.
+
+#define SHM_MAGIC 0x434d4854u // "THMC"
+#define SHM_ATTACH_RETRIES 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    _Atomic uint64_t generation; // 0 until the first publish
+} ShmControl;
+
+typedef struct {
+    TomlImage image;             // First, so release can get back to the ShmImage
+    const ShmControl *control;
+    char *name;
+    uint64_t generation;
+} ShmImage;
+
+static void data_segment_name(char *out, size_t size, const char *name, uint64_t generation) {
+    snprintf(out, size, "%s.%llu", name, (unsigned long long)generation);
+}
+
+static ShmControl *map_control(const char *name, int writable) {
+    int fd = shm_open(name, writable ? O_RDWR | O_CREAT : O_RDONLY, 0600);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (!writable && (size_t)st.st_size < sizeof(ShmControl))) {
+        close(fd);
+        return NULL;
+    }
+    if (writable && (size_t)st.st_size < sizeof(ShmControl) && ftruncate(fd, sizeof(ShmControl)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sizeof(ShmControl), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    ShmControl *control = (ShmControl *)map;
+    if (writable && control->magic == 0) control->magic = SHM_MAGIC; // Fresh segments read as zeros
+    if (control->magic != SHM_MAGIC) {
+        munmap(map, sizeof(ShmControl));
+        return NULL;
+    }
+    return control;
+}
+
+// Map the image of the current generation. A publisher may retire the segment
+// between reading the generation and opening it, so try again with the newer one.
+static int map_current(const ShmControl *control, const char *name, const unsigned char **base, size_t *size, uint64_t *generation) {
+    char segment[256];
+
+    for (int attempt = 0; attempt < SHM_ATTACH_RETRIES; attempt++) {
+        uint64_t current = atomic_load_explicit(&((ShmControl *)control)->generation, memory_order_acquire);
+        if (current == 0) return -1; // Nothing published yet
+
+        data_segment_name(segment, sizeof(segment), name, current);
+        int fd = shm_open(segment, O_RDONLY, 0);
+        if (fd < 0) {
+            if (errno == ENOENT) continue;
+            return -1;
+        }
+
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) return -1;
+
+        if (image_check(map, (size_t)st.st_size) != 0 || image_generation(map) != current) {
+            munmap(map, (size_t)st.st_size);
+            return -1;
+        }
+
+        *base = map;
+        *size = (size_t)st.st_size;
+        *generation = current;
+        return 0;
+    }
+    return -1;
+}
+
+static void shm_release(TomlImage *image) {
+    ShmImage *shm = (ShmImage *)image;
+    munmap((void *)shm->image.base, shm->image.size);
+    munmap((void *)shm->control, sizeof(ShmControl));
+    free(shm->name);
+    free(shm);
+}
+
+int tomlinc_shm_publish(const TomlTable *root_table, const char *name) {
+    if (!root_table || !name || name[0] != '/') return -1;
+    if (root_table->doc && (root_table->doc->overlay || root_table->doc->image)) return -1;
+
+    ShmControl *control = map_control(name, 1);
+    if (!control) return -1;
+
+    uint64_t previous = atomic_load_explicit(&control->generation, memory_order_relaxed);
+    uint64_t generation = previous + 1;
+
+    size_t size;
+    unsigned char *image = image_build(root_table, generation, &size);
+    if (!image) {
+        munmap(control, sizeof(ShmControl));
+        return -1;
+    }
+
+    char segment[256];
+    data_segment_name(segment, sizeof(segment), name, generation);
+    shm_unlink(segment); // Left behind by a publisher that died halfway
+
+    int result = -1;
+    int fd = shm_open(segment, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = write(fd, image + written, size - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += (size_t)n;
+        }
+        close(fd);
+
+        if (written == size) {
+            // Readers that see the new generation find the finished segment
+            atomic_store_explicit(&control->generation, generation, memory_order_release);
+            if (previous > 0) {
+                // Processes that still map the old version keep it until they refresh
+                data_segment_name(segment, sizeof(segment), name, previous);
+                shm_unlink(segment);
+            }
+            result = 0;
+        } else {
+            shm_unlink(segment);
+        }
+    }
+
+    free(image);
+    munmap(control, sizeof(ShmControl));
+    return result;
+}
+
+int tomlinc_shm_unpublish(const char *name) {
+    if (!name) return -1;
+
+    ShmControl *control = map_control(name, 0);
+    if (!control) return -1;
+
+    char segment[256];
+    data_segment_name(segment, sizeof(segment), name,
+                      atomic_load_explicit(&control->generation, memory_order_acquire));
+    munmap(control, sizeof(ShmControl));
+
+    shm_unlink(segment);
+    return shm_unlink(name);
+}
+
+TomlTable *tomlinc_shm_attach(const char *name) {
+    if (!name) return NULL;
+
+    ShmImage *shm = calloc(1, sizeof(ShmImage));
+    if (!shm) return NULL;
+
+    shm->name = strdup(name);
+    shm->control = map_control(name, 0);
+    if (!shm->name || !shm->control ||
+        map_current(shm->control, name, &shm->image.base, &shm->image.size, &shm->generation) != 0) {
+        if (shm->control) munmap((void *)shm->control, sizeof(ShmControl));
+        free(shm->name);
+        free(shm);
+        return NULL;
+    }
+    shm->image.release = shm_release;
+
+    TomlTable *handle = image_handle_create(&shm->image);
+    if (!handle) shm_release(&shm->image);
+    return handle;
+}
+
+// Switch the handle to the newest published version. Returns 1 when it moved,
+// 0 when it was already current and -1 on errors, in which case the handle
+// keeps the version it had.
+int tomlinc_shm_refresh(TomlTable *handle) {
+    if (!handle || !handle->doc || !handle->doc->image) return -1;
+    if (handle->doc->image->release != shm_release) return -1;
+
+    ShmImage *shm = (ShmImage *)handle->doc->image;
+    uint64_t current = atomic_load_explicit(&((ShmControl *)shm->control)->generation, memory_order_acquire);
+    if (current == shm->generation) return 0;
+
+    const unsigned char *base;
+    size_t size;
+    uint64_t generation;
+    if (map_current(shm->control, shm->name, &base, &size, &generation) != 0) return -1;
+
+    munmap((void *)shm->image.base, shm->image.size);
+    shm->image.base = base;
+    shm->image.size = size;
+    shm->generation = generation;
+    handle->doc->generation = generation; // Overlays and indexes over the handle see the change
+    return 1;
+}
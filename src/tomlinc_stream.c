@@ -0,0 +1,144 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pull iterator over the elements of one array of tables in a file. Lines
+// outside the wanted records are only checked for a table header or stepped
+// over with skip_pair, and each record is parsed into a small tree of its own
+// that is freed when the next one is requested, so memory stays bounded by the
+// largest record.
+
+struct TomlAotStream {
+    FILE *file;
+    char *table_path;
+    size_t path_len;
+    TomlTable *record; // Tree holding the current element, freed by the next call
+    int pending;       // The last line read was the header of the next record
+    char *line;
+    size_t line_capacity;
+};
+
+// Return the name of a [table] or [[table]] header, NULL for other lines. Modifies the line.
+static char *header_name(char *trimmed, int *is_array) {
+    if (*trimmed != '[') return NULL;
+
+    char *end;
+    if (trimmed[1] == '[') {
+        end = strstr(trimmed, "]]");
+        *is_array = 1;
+    } else {
+        end = strchr(trimmed, ']');
+        *is_array = 0;
+    }
+    if (!end) return NULL; // malformed
+
+    *end = '\0';
+    return trim_whitespace(trimmed + (*is_array ? 2 : 1));
+}
+
+static int is_record_header(const TomlAotStream *stream, const char *name, int is_array) {
+    return is_array && strcmp(name, stream->table_path) == 0;
+}
+
+// [path.sub] and [[path.sub]] headers continue the current record
+static int is_record_subtable(const TomlAotStream *stream, const char *name) {
+    return strncmp(name, stream->table_path, stream->path_len) == 0 && name[stream->path_len] == '.';
+}
+
+TomlAotStream *tomlinc_aot_stream_open(const char *filename, const char *table_path) {
+    if (!filename || !table_path || !*table_path) return NULL;
+
+    TomlAotStream *stream = calloc(1, sizeof(TomlAotStream));
+    if (!stream) return NULL;
+
+    stream->table_path = strdup(table_path);
+    stream->file = fopen(filename, "r");
+    if (!stream->table_path || !stream->file) {
+        tomlinc_aot_stream_close(stream);
+        return NULL;
+    }
+    stream->path_len = strlen(table_path);
+    return stream;
+}
+
+// Returns the next element, valid until the next call or tomlinc_aot_stream_close,
+// or NULL at the end of the file
+const TomlTable *tomlinc_aot_stream_next(TomlAotStream *stream) {
+    if (!stream) return NULL;
+
+    free_tables(stream->record);
+    stream->record = NULL;
+
+    // Skip everything up to the next [[table_path]] header
+    while (!stream->pending) {
+        if (getline(&stream->line, &stream->line_capacity, stream->file) == -1) return NULL;
+
+        char *trimmed = trim_whitespace(stream->line);
+        if (*trimmed == '\0' || *trimmed == '#') continue;
+
+        if (*trimmed == '[') {
+            int is_array;
+            char *name = header_name(trimmed, &is_array);
+            if (name && is_record_header(stream, name, is_array)) stream->pending = 1;
+        } else {
+            // Multi-line arrays have to be consumed, their lines could pass for headers
+            skip_pair(trimmed, stream->file);
+        }
+    }
+    stream->pending = 0;
+
+    TomlTable *root = NULL;
+    TomlTable *element = find_or_create_array_of_tables(&root, stream->table_path);
+    stream->record = root;
+    if (!element) return NULL;
+
+    TomlTable *current_table = element;
+    while (getline(&stream->line, &stream->line_capacity, stream->file) != -1) {
+        char *trimmed = trim_whitespace(stream->line);
+
+        // Skip empty lines and comments
+        if (*trimmed == '\0' || *trimmed == '#') continue;
+
+        if (*trimmed == '[') {
+            int is_array;
+            char *name = header_name(trimmed, &is_array);
+            if (!name) continue; // malformed
+
+            if (is_record_header(stream, name, is_array)) {
+                stream->pending = 1;
+                break;
+            }
+            if (!is_record_subtable(stream, name)) break; // The record ends here
+
+            current_table = is_array ? find_or_create_array_of_tables(&root, name)
+                                     : find_or_create_table(&root, name);
+        } else if (current_table) {
+            // key-value pairs
+            TomlPair *pair = parse_pair(trimmed, stream->file);
+            if (pair) {
+                if (!current_table->pairs) {
+                    current_table->pairs = pair;
+                } else {
+                    TomlPair *last_pair = current_table->pairs;
+                    while (last_pair->next) last_pair = last_pair->next;
+                    last_pair->next = pair;
+                }
+            }
+        }
+    }
+
+    rehash_tables(root);
+    return element;
+}
+
+void tomlinc_aot_stream_close(TomlAotStream *stream) {
+    if (!stream) return;
+
+    free_tables(stream->record);
+    if (stream->file) fclose(stream->file);
+    free(stream->table_path);
+    free(stream->line);
+    free(stream);
+}
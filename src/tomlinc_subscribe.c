@@ -0,0 +1,302 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Change subscriptions. Listeners are kept in one hash index: a subscription
+// to a single key is filed under its table path and key, one to a subtree
+// under its table path alone. A change to key in "a.b.c" therefore probes the
+// key's own entry and then "a.b.c", "a.b", "a" and the root, one lookup per
+// level no matter how many listeners exist.
+//
+// Paths are compared without empty segments, so "a..b" and ".a.b" match
+// "a.b" the way the setters resolve them.
+
+#define SUBSCRIPTION_MIN_BUCKETS 16
+
+struct TomlSubscription {
+    char *table_path;                // Normalized, "" for the root table
+    char *key;                       // NULL for every key in the subtree
+    uint64_t hash;
+    TomlChangeCallback callback;
+    void *userdata;
+    int removed;                     // Unsubscribed while callbacks were running
+    struct TomlSubscription *next;   // Bucket chain
+};
+
+typedef struct {
+    char *table_path;
+    char *key;
+} PendingChange;
+
+struct TomlSubscriptions {
+    TomlSubscription **buckets;
+    size_t bucket_count;
+    size_t count;                    // Live subscriptions
+    size_t removed;                  // Unlinked once no callback is running
+    int dispatching;                 // Nesting depth of callbacks
+
+    // Changes staged in the open transaction, delivered on commit
+    PendingChange *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+};
+
+// Drop empty segments, out must hold strlen(table_path) + 1 bytes
+static size_t normalize_path(const char *table_path, char *out) {
+    size_t length = 0;
+    while (*table_path) {
+        if (*table_path == '.') {
+            table_path++;
+            continue;
+        }
+        size_t len = strcspn(table_path, ".");
+        if (length > 0) out[length++] = '.';
+        memcpy(out + length, table_path, len);
+        length += len;
+        table_path += len;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+static uint64_t subtree_hash(const char *path, size_t length) {
+    return hash_bytes(1, path, length);
+}
+
+static uint64_t key_hash(const char *path, size_t length, const char *key) {
+    return hash_string(hash_bytes(2, path, length), key);
+}
+
+static int subscription_matches(const TomlSubscription *subscription, const char *path, size_t length, const char *key) {
+    if (subscription->removed) return 0;
+    if (strlen(subscription->table_path) != length || memcmp(subscription->table_path, path, length) != 0) return 0;
+    if (!key) return subscription->key == NULL;
+    return subscription->key && strcmp(subscription->key, key) == 0;
+}
+
+static int subscriptions_grow(TomlSubscriptions *subscriptions) {
+    size_t bucket_count = subscriptions->bucket_count ? subscriptions->bucket_count * 2 : SUBSCRIPTION_MIN_BUCKETS;
+    TomlSubscription **buckets = calloc(bucket_count, sizeof(TomlSubscription *));
+    if (!buckets) return -1;
+
+    for (size_t i = 0; i < subscriptions->bucket_count; i++) {
+        TomlSubscription *subscription = subscriptions->buckets[i];
+        while (subscription) {
+            TomlSubscription *next = subscription->next;
+            size_t bucket = subscription->hash & (bucket_count - 1);
+            subscription->next = buckets[bucket];
+            buckets[bucket] = subscription;
+            subscription = next;
+        }
+    }
+    free(subscriptions->buckets);
+    subscriptions->buckets = buckets;
+    subscriptions->bucket_count = bucket_count;
+    return 0;
+}
+
+// Call the listeners filed under hash that match path and key. Returns how
+// many there were, without calling them when callback_root is NULL.
+static size_t notify_bucket(TomlSubscriptions *subscriptions, TomlTable *callback_root, uint64_t hash,
+                            const char *path, size_t length, const char *key, const char *changed_path, const char *changed_key) {
+    size_t matched = 0;
+    // Chains are never rehashed during callbacks, and removed entries stay linked until the sweep, so
+    // callbacks may subscribe and unsubscribe. Whether a subscription they add sees this change is unspecified.
+    for (TomlSubscription *subscription = subscriptions->buckets[hash & (subscriptions->bucket_count - 1)];
+         subscription; subscription = subscription->next) {
+        if (subscription->hash != hash || !subscription_matches(subscription, path, length, key)) continue;
+        matched++;
+        if (callback_root) subscription->callback(callback_root, changed_path, changed_key, subscription->userdata);
+    }
+    return matched;
+}
+
+static size_t notify_matches(TomlSubscriptions *subscriptions, TomlTable *callback_root, const char *path, size_t length, const char *key) {
+    size_t matched = notify_bucket(subscriptions, callback_root, key_hash(path, length, key), path, length, key, path, key);
+
+    // The table itself, then each parent up to the root
+    size_t prefix = length;
+    for (;;) {
+        matched += notify_bucket(subscriptions, callback_root, subtree_hash(path, prefix), path, prefix, NULL, path, key);
+        if (prefix == 0) break;
+        while (prefix > 0 && path[prefix - 1] != '.') prefix--;
+        if (prefix > 0) prefix--; // Drop the dot as well
+    }
+    return matched;
+}
+
+// Unlink the subscriptions removed while callbacks were running
+static void sweep_removed(TomlSubscriptions *subscriptions) {
+    for (size_t i = 0; i < subscriptions->bucket_count && subscriptions->removed > 0; i++) {
+        TomlSubscription **link = &subscriptions->buckets[i];
+        while (*link) {
+            TomlSubscription *subscription = *link;
+            if (!subscription->removed) {
+                link = &subscription->next;
+                continue;
+            }
+            *link = subscription->next;
+            free(subscription->table_path);
+            free(subscription->key);
+            free(subscription);
+            subscriptions->removed--;
+        }
+    }
+}
+
+static void dispatch(TomlTable *root, const char *path, size_t length, const char *key) {
+    TomlSubscriptions *subscriptions = root->doc->subscriptions;
+
+    subscriptions->dispatching++;
+    notify_matches(subscriptions, root, path, length, key);
+    subscriptions->dispatching--;
+
+    if (subscriptions->dispatching == 0 && subscriptions->removed > 0) sweep_removed(subscriptions);
+}
+
+// Remember a change made inside a transaction, if anyone listens for it
+static void queue_change(TomlSubscriptions *subscriptions, const char *path, size_t length, const char *key) {
+    if (notify_matches(subscriptions, NULL, path, length, key) == 0) return;
+
+    if (subscriptions->pending_count == subscriptions->pending_capacity) {
+        size_t new_capacity = subscriptions->pending_capacity ? subscriptions->pending_capacity * 2 : 8;
+        PendingChange *new_pending = realloc(subscriptions->pending, sizeof(PendingChange) * new_capacity);
+        if (!new_pending) return; // The notification is lost, the change itself is not
+        subscriptions->pending = new_pending;
+        subscriptions->pending_capacity = new_capacity;
+    }
+
+    PendingChange *change = &subscriptions->pending[subscriptions->pending_count];
+    change->table_path = strdup(path);
+    change->key = strdup(key);
+    if (!change->table_path || !change->key) {
+        free(change->table_path);
+        free(change->key);
+        return;
+    }
+    subscriptions->pending_count++;
+}
+
+// Called by the setters after a change was made or staged
+void subscriptions_notify(TomlTable *root, const char *table_path, const char *key) {
+    TomlSubscriptions *subscriptions = root->doc->subscriptions;
+    if (subscriptions->count == 0) return;
+
+    char stack_path[256];
+    size_t size = strlen(table_path) + 1;
+    char *path = size <= sizeof(stack_path) ? stack_path : malloc(size);
+    if (!path) return;
+    size_t length = normalize_path(table_path, path);
+
+    if (root->doc->txn) {
+        queue_change(subscriptions, path, length, key);
+    } else {
+        dispatch(root, path, length, key);
+    }
+
+    if (path != stack_path) free(path);
+}
+
+// Deliver or drop the changes of a transaction once it ends
+void subscriptions_txn_end(TomlTable *root, int committed) {
+    TomlSubscriptions *subscriptions = root->doc->subscriptions;
+    PendingChange *pending = subscriptions->pending;
+    size_t pending_count = subscriptions->pending_count;
+
+    // Callbacks may open the next transaction, it starts with an empty queue
+    subscriptions->pending = NULL;
+    subscriptions->pending_count = 0;
+    subscriptions->pending_capacity = 0;
+
+    for (size_t i = 0; i < pending_count; i++) {
+        if (committed) {
+            dispatch(root, pending[i].table_path, strlen(pending[i].table_path), pending[i].key);
+        }
+        free(pending[i].table_path);
+        free(pending[i].key);
+    }
+    free(pending);
+}
+
+void subscriptions_free(TomlSubscriptions *subscriptions) {
+    if (!subscriptions) return;
+
+    for (size_t i = 0; i < subscriptions->bucket_count; i++) {
+        TomlSubscription *subscription = subscriptions->buckets[i];
+        while (subscription) {
+            TomlSubscription *next = subscription->next;
+            free(subscription->table_path);
+            free(subscription->key);
+            free(subscription);
+            subscription = next;
+        }
+    }
+    for (size_t i = 0; i < subscriptions->pending_count; i++) {
+        free(subscriptions->pending[i].table_path);
+        free(subscriptions->pending[i].key);
+    }
+    free(subscriptions->pending);
+    free(subscriptions->buckets);
+    free(subscriptions);
+}
+
+// Listen for changes to key in table_path, or to any key in table_path and
+// the tables below it when key is NULL ("" is the root table)
+TomlSubscription *tomlinc_subscribe(TomlTable *root_table, const char *table_path, const char *key, TomlChangeCallback callback, void *userdata) {
+    if (!root_table || !table_path || !callback || !root_table->doc) return NULL;
+    if (root_table->doc->overlay || root_table->doc->image) return NULL; // Read-only handles
+    if (root_table->doc->pool) return NULL; // Listeners would live on the heap
+
+    TomlSubscriptions *subscriptions = root_table->doc->subscriptions;
+    if (!subscriptions) {
+        subscriptions = calloc(1, sizeof(TomlSubscriptions));
+        if (!subscriptions) return NULL;
+        if (subscriptions_grow(subscriptions) != 0) {
+            free(subscriptions);
+            return NULL;
+        }
+        root_table->doc->subscriptions = subscriptions;
+    }
+
+    // Keep chains short, but never rehash under a running callback
+    if (subscriptions->dispatching == 0 && subscriptions->count + subscriptions->removed >= subscriptions->bucket_count) {
+        if (subscriptions->removed > 0) sweep_removed(subscriptions);
+        if (subscriptions->count >= subscriptions->bucket_count) subscriptions_grow(subscriptions); // Still works when this fails
+    }
+
+    TomlSubscription *subscription = calloc(1, sizeof(TomlSubscription));
+    if (!subscription) return NULL;
+    subscription->table_path = malloc(strlen(table_path) + 1);
+    subscription->key = key ? strdup(key) : NULL;
+    if (!subscription->table_path || (key && !subscription->key)) {
+        free(subscription->table_path);
+        free(subscription->key);
+        free(subscription);
+        return NULL;
+    }
+
+    size_t length = normalize_path(table_path, subscription->table_path);
+    subscription->hash = key ? key_hash(subscription->table_path, length, key) : subtree_hash(subscription->table_path, length);
+    subscription->callback = callback;
+    subscription->userdata = userdata;
+
+    size_t bucket = subscription->hash & (subscriptions->bucket_count - 1);
+    subscription->next = subscriptions->buckets[bucket];
+    subscriptions->buckets[bucket] = subscription;
+    subscriptions->count++;
+    return subscription;
+}
+
+// Safe to call from a callback, including for the subscription being called
+void tomlinc_unsubscribe(TomlTable *root_table, TomlSubscription *subscription) {
+    if (!root_table || !subscription || !root_table->doc || !root_table->doc->subscriptions) return;
+    TomlSubscriptions *subscriptions = root_table->doc->subscriptions;
+    if (subscription->removed) return;
+
+    subscription->removed = 1;
+    subscriptions->count--;
+    subscriptions->removed++;
+    if (subscriptions->dispatching == 0) sweep_removed(subscriptions);
+}
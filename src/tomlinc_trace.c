@@ -0,0 +1,26 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stddef.h>
+
+// Process-wide trace callback. The TRACE macro only loads trace_callback, so
+// an unset callback costs one load and a branch per event; the USDT probes
+// next to it are nops until a tracer attaches.
+
+_Atomic(TomlTraceCallback) trace_callback = NULL;
+static void *_Atomic trace_userdata = NULL;
+
+void trace_emit(TomlTraceSpan span, int end, const char *name, const char *key, size_t bytes, size_t nodes) {
+    TomlTraceCallback callback = atomic_load_explicit(&trace_callback, memory_order_acquire);
+    if (!callback) return; // Cleared since the check
+
+    TomlTraceEvent event = { span, end, name, key, bytes, nodes };
+    callback(&event, atomic_load_explicit(&trace_userdata, memory_order_relaxed));
+}
+
+// NULL turns tracing off. The callback runs on whichever thread does the
+// traced work; replace it only while no other thread uses the library.
+void tomlinc_set_trace_callback(TomlTraceCallback callback, void *userdata) {
+    atomic_store_explicit(&trace_callback, NULL, memory_order_relaxed);
+    atomic_store_explicit(&trace_userdata, userdata, memory_order_relaxed);
+    atomic_store_explicit(&trace_callback, callback, memory_order_release); // Publishes userdata
+}
@@ -0,0 +1,193 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Transactions stage every mutation with its new value already allocated, so
+// applying them on commit is a sequence of pointer swaps that cannot fail.
+// Array additions are the exception; their storage is reserved up front.
+
+typedef struct {
+    TomlTxnOpKind kind;
+    TomlTable *table;
+    TomlPair *pair;
+    size_t index;
+    void *value;            // Staged value, or the replaced value once applied
+    TomlValueType type;
+    size_t precision;
+} TxnOp;
+
+struct TomlTxn {
+    TomlTable *root;
+    TxnOp *ops;
+    size_t count;
+    size_t capacity;
+};
+
+TomlTxn *tomlinc_txn_begin(TomlTable *root_table) {
+    if (!root_table || !root_table->doc) return NULL;
+    if (root_table->doc->txn) return NULL; // Transactions do not nest
+    if (root_table->doc->overlay || root_table->doc->image || root_table->doc->pool) return NULL;
+
+    TomlTxn *txn = calloc(1, sizeof(TomlTxn));
+    if (!txn) return NULL;
+
+    txn->root = root_table;
+    root_table->doc->txn = txn;
+    return txn;
+}
+
+int txn_stage(TomlTxn *txn, TomlTxnOpKind kind, TomlTable *table, TomlPair *pair, size_t index, void *value, TomlValueType type, size_t precision) {
+    if (txn->count == txn->capacity) {
+        size_t new_capacity = txn->capacity ? txn->capacity * 2 : 16;
+        TxnOp *new_ops = realloc(txn->ops, sizeof(TxnOp) * new_capacity);
+        if (!new_ops) {
+            free_value(value, type);
+            return -1; // Memory allocation failed
+        }
+        txn->ops = new_ops;
+        txn->capacity = new_capacity;
+    }
+
+    TxnOp *op = &txn->ops[txn->count++];
+    op->kind = kind;
+    op->table = table;
+    op->pair = pair;
+    op->index = index;
+    op->value = value;
+    op->type = type;
+    op->precision = precision;
+    return 0;
+}
+
+// Element count of an array as it will be once the staged additions are applied
+size_t txn_array_count(const TomlTxn *txn, const TomlPair *pair) {
+    size_t count = ((const TomlArray *)pair->value)->count;
+    for (size_t i = 0; i < txn->count; i++) {
+        if (txn->ops[i].kind == TXN_ARRAY_ADD && txn->ops[i].pair == pair) count++;
+    }
+    return count;
+}
+
+// Swap the staged value in. Applying an op a second time undoes it.
+static void txn_apply(TxnOp *op) {
+    TomlArray *array = (TomlArray *)op->pair->value;
+    void *value = op->value;
+    uint64_t old_hash = pair_hash(op->table, op->pair);
+
+    switch (op->kind) {
+        case TXN_SET_VALUE:
+            op->value = op->pair->value;
+            op->pair->value = value;
+            break;
+        case TXN_ARRAY_SET: {
+            TomlValueType type = array->types[op->index];
+            size_t precision = array->float_precisions[op->index];
+            op->value = array->values[op->index];
+            array->values[op->index] = value;
+            array->types[op->index] = op->type;
+            array->float_precisions[op->index] = op->precision;
+            op->type = type;
+            op->precision = precision;
+            break;
+        }
+        case TXN_ARRAY_ADD:
+            return; // Handled by txn_apply_add/txn_undo_add
+    }
+    uint64_t new_hash = pair_hash(op->table, op->pair);
+    table_hash_update(op->table, old_hash, new_hash);
+    indexes_changed(op->table, op->pair, op->kind == TXN_SET_VALUE ? op->value : NULL, new_hash - old_hash);
+}
+
+static void txn_apply_add(TxnOp *op) {
+    TomlArray *array = (TomlArray *)op->pair->value;
+    uint64_t old_hash = pair_hash(op->table, op->pair);
+    array->values[array->count] = op->value;
+    array->types[array->count] = op->type;
+    array->float_precisions[array->count] = op->precision;
+    array->count++;
+    op->value = NULL;
+    uint64_t new_hash = pair_hash(op->table, op->pair);
+    table_hash_update(op->table, old_hash, new_hash);
+    indexes_changed(op->table, op->pair, NULL, new_hash - old_hash);
+}
+
+static void txn_undo_add(TxnOp *op) {
+    TomlArray *array = (TomlArray *)op->pair->value;
+    uint64_t old_hash = pair_hash(op->table, op->pair);
+    array->count--;
+    op->value = array->values[array->count];
+    uint64_t new_hash = pair_hash(op->table, op->pair);
+    table_hash_update(op->table, old_hash, new_hash);
+    indexes_changed(op->table, op->pair, NULL, new_hash - old_hash);
+}
+
+// Free whatever the ops still own and detach the transaction from its document
+void txn_discard(TomlTxn *txn) {
+    for (size_t i = 0; i < txn->count; i++) {
+        if (txn->ops[i].value) free_value(txn->ops[i].value, txn->ops[i].type);
+    }
+    if (txn->root->doc->txn == txn) txn->root->doc->txn = NULL;
+    free(txn->ops);
+    free(txn);
+}
+
+int tomlinc_txn_commit(TomlTxn *txn, const char *filename) {
+    if (!txn) return -1;
+
+    // Reserve array storage up front, including room for the additions
+    for (size_t i = 0; i < txn->count; i++) {
+        TxnOp *op = &txn->ops[i];
+        if (op->kind == TXN_SET_VALUE) continue;
+
+        TomlArray *array = (TomlArray *)op->pair->value;
+        size_t needed = op->index + 1 > array->count ? op->index + 1 : array->count;
+        if (array_reserve(array, needed) != 0) {
+            txn_discard(txn);
+            return -1; // Memory allocation failed, nothing was applied
+        }
+    }
+
+    // From here on the setters act on the document directly again
+    txn->root->doc->txn = NULL;
+
+    autosave_lock(txn->root); // The writer must not save changes that get rolled back
+    for (size_t i = 0; i < txn->count; i++) {
+        if (txn->ops[i].kind == TXN_ARRAY_ADD) {
+            txn_apply_add(&txn->ops[i]);
+        } else {
+            txn_apply(&txn->ops[i]);
+        }
+    }
+
+    // The file is replaced as a whole, a failed save leaves the old one in place.
+    // Once it was replaced the commit stands, even if the directory sync failed.
+    int result = filename ? save_file_durable(txn->root, filename) : 0;
+    if (result < 0) {
+        // Roll back in reverse order, a failed commit leaves the document unchanged
+        for (size_t i = txn->count; i-- > 0;) {
+            if (txn->ops[i].kind == TXN_ARRAY_ADD) {
+                txn_undo_add(&txn->ops[i]);
+            } else {
+                txn_apply(&txn->ops[i]);
+            }
+        }
+        result = -1;
+    }
+
+    int applied = result >= 0;
+    autosave_unlock(txn->root, applied && txn->count > 0);
+    txn->root->doc->generation++;
+    if (txn->root->doc->journal) journal_txn_end(txn->root, applied);
+    if (txn->root->doc->subscriptions) subscriptions_txn_end(txn->root, applied);
+    txn_discard(txn);
+    return result;
+}
+
+void tomlinc_txn_abort(TomlTxn *txn) {
+    if (!txn) return;
+    if (txn->root->doc->journal) journal_txn_end(txn->root, 0);
+    if (txn->root->doc->subscriptions) subscriptions_txn_end(txn->root, 0);
+    txn_discard(txn);
+}
@@ -0,0 +1,294 @@
+#include "tomlinc.h"
+#include "tomlinc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+// Build-time generator used by the tomlinc_embed() CMake helper.
+// Parses a TOML file with the regular parser and writes it back out as static
+// const TomlTable/TomlPair/TomlArray objects, so the runtime read API works on
+// it without parsing or allocating anything at startup.
+
+typedef struct {
+    FILE *decls;    // Forward declarations, written first
+    FILE *defs;     // Definitions, appended after all declarations
+    unsigned next_id;
+} EmbedWriter;
+
+static void emit_string_literal(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20 || *c >= 0x7f) {
+            fprintf(out, "\\%03o", *c); // Octal escapes cannot swallow following digits
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_float_literal(FILE *out, float value) {
+    if (isnan(value)) {
+        fprintf(out, "NAN");
+    } else if (isinf(value)) {
+        fprintf(out, "%sINFINITY", value < 0 ? "-" : "");
+    } else {
+        fprintf(out, "%af", value); // Hex float keeps the exact bit pattern
+    }
+}
+
+// Write an expression referencing the value to out, emitting its backing object if needed
+static void emit_value_ref(EmbedWriter *w, const void *value, TomlValueType type, FILE *out);
+
+static unsigned emit_array(EmbedWriter *w, const TomlArray *array) {
+    unsigned id = w->next_id++;
+
+    // Elements first; definition order does not matter thanks to the declarations
+    char **refs = calloc(array->count ? array->count : 1, sizeof(char *));
+    if (!refs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < array->count; i++) {
+        char *buffer = NULL;
+        size_t size = 0;
+        FILE *ref = open_memstream(&buffer, &size);
+        if (!ref) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        emit_value_ref(w, array->values[i], array->types[i], ref);
+        fclose(ref);
+        refs[i] = buffer;
+    }
+
+    if (array->count) {
+        fprintf(w->decls, "static void *const tomlinc_a%u_values[%zu];\n", id, array->count);
+        fprintf(w->defs, "static void *const tomlinc_a%u_values[%zu] = {\n", id, array->count);
+        for (size_t i = 0; i < array->count; i++) {
+            fprintf(w->defs, "    %s,\n", refs[i]);
+            free(refs[i]);
+        }
+        fprintf(w->defs, "};\n");
+
+        fprintf(w->defs, "static const TomlValueType tomlinc_a%u_types[%zu] = {", id, array->count);
+        for (size_t i = 0; i < array->count; i++) {
+            fprintf(w->defs, "%s%d", i ? ", " : "", (int)array->types[i]);
+        }
+        fprintf(w->defs, "};\n");
+
+        if (array->float_precisions) {
+            // Precisions are only meaningful (and only allocated) for float slots
+            fprintf(w->defs, "static const size_t tomlinc_a%u_precisions[%zu] = {", id, array->count);
+            for (size_t i = 0; i < array->count; i++) {
+                size_t precision = array->types[i] == TOML_VALUE_FLOAT ? array->float_precisions[i] : 0;
+                fprintf(w->defs, "%s%zu", i ? ", " : "", precision);
+            }
+            fprintf(w->defs, "};\n");
+        }
+    }
+    free(refs);
+
+    fprintf(w->decls, "static const TomlArray tomlinc_a%u;\n", id);
+    fprintf(w->defs, "static const TomlArray tomlinc_a%u = {\n", id);
+    if (array->count) {
+        fprintf(w->defs, "    .values = (void **)tomlinc_a%u_values,\n", id);
+        fprintf(w->defs, "    .types = (TomlValueType *)tomlinc_a%u_types,\n", id);
+        if (array->float_precisions) {
+            fprintf(w->defs, "    .float_precisions = (size_t *)tomlinc_a%u_precisions,\n", id);
+        }
+    }
+    fprintf(w->defs, "    .count = %zu,\n};\n", array->count);
+    return id;
+}
+
+static void emit_value_ref(EmbedWriter *w, const void *value, TomlValueType type, FILE *out) {
+    unsigned id;
+    switch (type) {
+        case TOML_VALUE_STRING:
+            fprintf(out, "(void *)");
+            emit_string_literal(out, (const char *)value);
+            break;
+        case TOML_VALUE_INT:
+        case TOML_VALUE_BOOL:
+            id = w->next_id++;
+            fprintf(w->defs, "static const int tomlinc_v%u = %d;\n", id, *(const int *)value);
+            fprintf(out, "(void *)&tomlinc_v%u", id);
+            break;
+        case TOML_VALUE_FLOAT:
+            id = w->next_id++;
+            fprintf(w->defs, "static const float tomlinc_v%u = ", id);
+            emit_float_literal(w->defs, *(const float *)value);
+            fprintf(w->defs, ";\n");
+            fprintf(out, "(void *)&tomlinc_v%u", id);
+            break;
+        case TOML_VALUE_ARRAY:
+            id = emit_array(w, (const TomlArray *)value);
+            fprintf(out, "(void *)&tomlinc_a%u", id);
+            break;
+        default:
+            fprintf(out, "NULL");
+    }
+}
+
+static unsigned emit_pairs(EmbedWriter *w, const TomlPair *pair) {
+    unsigned next_id = 0;
+    if (!pair) return 0;
+
+    // Walk the list once, emitting every pair with a reference to its successor's id
+    unsigned first_id = w->next_id;
+    for (; pair; pair = pair->next) {
+        unsigned id = next_id ? next_id : w->next_id++;
+        next_id = pair->next ? w->next_id++ : 0;
+
+        char *value_ref = NULL;
+        size_t size = 0;
+        FILE *ref = open_memstream(&value_ref, &size);
+        if (!ref) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        emit_value_ref(w, pair->value, pair->type, ref);
+        fclose(ref);
+
+        fprintf(w->decls, "static const TomlPair tomlinc_p%u;\n", id);
+        fprintf(w->defs, "static const TomlPair tomlinc_p%u = {\n    .key = (char *)", id);
+        emit_string_literal(w->defs, pair->key);
+        fprintf(w->defs, ",\n    .value = %s,\n    .type = %d,\n", value_ref, (int)pair->type);
+        if (next_id) fprintf(w->defs, "    .next = (TomlPair *)&tomlinc_p%u,\n", next_id);
+        fprintf(w->defs, "};\n");
+        free(value_ref);
+    }
+    return first_id;
+}
+
+// ids, when given, receives the id of every table in the list
+static unsigned emit_tables(EmbedWriter *w, const TomlTable *table, unsigned parent_id, unsigned *ids) {
+    unsigned first_id = 0;
+    unsigned next_id = 0;
+
+    for (size_t n = 0; table; table = table->next, n++) {
+        unsigned id = next_id ? next_id : w->next_id++;
+        if (!first_id) first_id = id;
+        if (ids) ids[n] = id;
+        next_id = table->next ? w->next_id++ : 0;
+
+        size_t element_count = 0;
+        for (const TomlTable *element = table->array_of_tables; element; element = element->next) {
+            element_count++;
+        }
+        unsigned *element_ids = calloc(element_count ? element_count : 1, sizeof(unsigned));
+        if (!element_ids) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+
+        unsigned pairs_id = emit_pairs(w, table->pairs);
+        unsigned subtables_id = emit_tables(w, table->subtables, id, NULL);
+        unsigned aot_id = emit_tables(w, table->array_of_tables, id, element_ids);
+
+        if (element_count) {
+            fprintf(w->defs, "static TomlTable *const tomlinc_t%u_elements[%zu] = {", id, element_count);
+            for (size_t i = 0; i < element_count; i++) {
+                fprintf(w->defs, "%s(TomlTable *)&tomlinc_t%u", i ? ", " : "", element_ids[i]);
+            }
+            fprintf(w->defs, "};\n");
+        }
+
+        fprintf(w->decls, "static const TomlTable tomlinc_t%u;\n", id);
+        fprintf(w->defs, "static const TomlTable tomlinc_t%u = {\n    .name = (char *)", id);
+        emit_string_literal(w->defs, table->name);
+        fprintf(w->defs, ",\n");
+        if (pairs_id) fprintf(w->defs, "    .pairs = (TomlPair *)&tomlinc_p%u,\n", pairs_id);
+        if (subtables_id) fprintf(w->defs, "    .subtables = (TomlTable *)&tomlinc_t%u,\n", subtables_id);
+        if (next_id) fprintf(w->defs, "    .next = (TomlTable *)&tomlinc_t%u,\n", next_id);
+        if (aot_id) {
+            fprintf(w->defs, "    .array_of_tables = (TomlTable *)&tomlinc_t%u,\n", aot_id);
+            fprintf(w->defs, "    .array_of_tables_last = (TomlTable *)&tomlinc_t%u,\n", element_ids[element_count - 1]);
+            fprintf(w->defs, "    .elements = (TomlTable **)tomlinc_t%u_elements,\n", id);
+            fprintf(w->defs, "    .element_count = %zu,\n    .element_capacity = %zu,\n", element_count, element_count);
+        }
+        free(element_ids);
+        fprintf(w->defs, "    .is_array_of_tables_element = %d,\n", table->is_array_of_tables_element);
+        fprintf(w->defs, "    .is_array_container = %d,\n", table->is_array_container);
+        if (parent_id) fprintf(w->defs, "    .parent = (TomlTable *)&tomlinc_t%u,\n", parent_id);
+        fprintf(w->defs, "    .path_hash = 0x%016" PRIx64 "ULL,\n", table->path_hash);
+        fprintf(w->defs, "    .pairs_hash = 0x%016" PRIx64 "ULL,\n", table->pairs_hash);
+        fprintf(w->defs, "    .hash = 0x%016" PRIx64 "ULL,\n};\n", table->hash);
+    }
+    return first_id;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <TOML file> <symbol> <output .c> <output .h>\n", argv[0]);
+        return 1;
+    }
+    const char *input = argv[1];
+    const char *symbol = argv[2];
+
+    TomlTable *root = tomlinc_open_file(input);
+    if (!root) {
+        fprintf(stderr, "Failed to parse TOML file: %s\n", input);
+        return 1;
+    }
+
+    EmbedWriter w = {0};
+    w.next_id = 1; // 0 means "no object"
+    w.decls = tmpfile();
+    w.defs = tmpfile();
+    if (!w.decls || !w.defs) {
+        perror("tmpfile");
+        return 1;
+    }
+
+    unsigned root_id = emit_tables(&w, root, 0, NULL);
+    tomlinc_close_file(root);
+
+    FILE *c_file = fopen(argv[3], "w");
+    if (!c_file) {
+        perror("Failed to open output source");
+        return 1;
+    }
+    fprintf(c_file, "// Generated by tomlinc_embed from %s. Do not edit.\n", input);
+    fprintf(c_file, "#include \"%s.h\"\n#include \"tomlinc_internal.h\"\n#include <math.h>\n#include <stddef.h>\n\n", symbol);
+
+    // Tentative definitions let the definitions below reference each other in any order
+    FILE *sections[2] = { w.decls, w.defs };
+    for (int i = 0; i < 2; i++) {
+        char buffer[4096];
+        size_t n;
+        rewind(sections[i]);
+        while ((n = fread(buffer, 1, sizeof(buffer), sections[i])) > 0) {
+            fwrite(buffer, 1, n, c_file);
+        }
+        fprintf(c_file, "\n");
+        fclose(sections[i]);
+    }
+
+    if (root_id) {
+        fprintf(c_file, "const TomlTable *const %s = &tomlinc_t%u;\n", symbol, root_id);
+    } else {
+        fprintf(c_file, "const TomlTable *const %s = NULL;\n", symbol);
+    }
+    fclose(c_file);
+
+    FILE *h_file = fopen(argv[4], "w");
+    if (!h_file) {
+        perror("Failed to open output header");
+        return 1;
+    }
+    fprintf(h_file, "// Generated by tomlinc_embed from %s. Do not edit.\n", input);
+    fprintf(h_file, "#ifndef TOMLINC_EMBED_%s_H\n#define TOMLINC_EMBED_%s_H\n\n", symbol, symbol);
+    fprintf(h_file, "#include \"tomlinc.h\"\n\n");
+    fprintf(h_file, "// Read-only: use the tomlinc_get_* API, never setters or tomlinc_close_file\n");
+    fprintf(h_file, "extern const TomlTable *const %s;\n\n", symbol);
+    fprintf(h_file, "#endif // TOMLINC_EMBED_%s_H\n", symbol);
+    fclose(h_file);
+
+    return 0;
+}